@@ -0,0 +1,698 @@
+#include <core/core.h>
+#include <core/Camera.h>
+#include <core/Integrator.h>
+#include <core/Scene.h>
+#include <core/Object.h>
+#include <core/Material.h>
+#include <core/Mesh.h>
+#include <core/Light.h>
+#include <core/Interaction.h>
+#include <core/ObjFile.h>
+#include <core/Texture.h>
+
+#include <vendor/obj_loader/OBJ_Loader.h>
+
+#include <json/json.h>
+#include <filesystem>
+#include <fstream>
+#include <chrono>
+#include <execution>
+#include <numeric>
+#include <random>
+#include <thread>
+
+#ifdef MYPBRT_HAS_TBB
+#include <tbb/global_control.h>
+#endif
+
+//measures ray throughput and full frame render times of the saved scenes and a few generated ones, ex.
+//myPbrt_benchmark --output bench.json
+//every run traces the same rays, so numbers of two builds can be compared directly
+
+struct Options {
+    std::string root = ".";
+    std::string output = "";
+    std::string filter = "";
+    glm::ivec2 resolution = { 256, 256 };
+    //best of this many runs is reported
+    int repeat = 3;
+    int frame_samples = 4;
+    bool generated = true;
+    bool obj = true;
+    bool texture = true;
+    bool shading = true;
+};
+
+struct BenchmarkScene {
+    std::string name;
+    MyPBRT::Scene scene;
+};
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static std::vector<MyPBRT::Mesh::Vertex> uvSphere(int slices, int stacks, std::vector<uint32_t>& indices)
+{
+    std::vector<MyPBRT::Mesh::Vertex> vertices;
+    for (int j = 0; j <= stacks; j++) {
+        float theta = PIf * j / stacks;
+        for (int i = 0; i <= slices; i++) {
+            float phi = 2 * PIf * i / slices;
+            glm::vec3 normal(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+            vertices.push_back({ normal, normal, glm::vec2((float)i / slices, (float)j / stacks) });
+        }
+    }
+    for (int j = 0; j < stacks; j++) {
+        for (int i = 0; i < slices; i++) {
+            uint32_t a = j * (slices + 1) + i, b = a + slices + 1;
+            indices.insert(indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+        }
+    }
+    return vertices;
+}
+
+static void addDefaultMaterialAndLight(MyPBRT::Scene& scene)
+{
+    std::shared_ptr<MyPBRT::Texture> texture(new MyPBRT::ConstantTexture<glm::vec3>(glm::vec3(.75f)));
+    scene.materials.emplace_back(new MyPBRT::DiffuseMaterial(texture));
+    scene.lights.emplace_back(new MyPBRT::SphericalLight(glm::vec3(1), 100, glm::vec3(2, 6, 4), .5f));
+}
+
+//many small objects, stresses the scene level bvh
+static void generateInstances(MyPBRT::Scene& scene)
+{
+    addDefaultMaterialAndLight(scene);
+    for (int z = 0; z < 8; z++) {
+        for (int y = 0; y < 16; y++) {
+            for (int x = 0; x < 16; x++) {
+                std::vector<uint32_t> indices;
+                std::vector<MyPBRT::Mesh::Vertex> vertices = uvSphere(12, 6, indices);
+                for (auto& vertex : vertices) {
+                    vertex.position = vertex.position * 0.2f + glm::vec3(x - 7.5f, y - 7.5f, -z * 1.5f) * 0.5f;
+                }
+                scene.meshes.emplace_back(new MyPBRT::Mesh(vertices, indices));
+                scene.objects.push_back(MyPBRT::Object(scene.meshes.size() - 1, 0));
+            }
+        }
+    }
+    scene.Build();
+}
+
+//a single finely tesselated surface, stresses the mesh level bvh
+static void generateTriangles(MyPBRT::Scene& scene)
+{
+    addDefaultMaterialAndLight(scene);
+    const int size = 256;
+    std::vector<MyPBRT::Mesh::Vertex> vertices;
+    std::vector<uint32_t> indices;
+    for (int y = 0; y <= size; y++) {
+        for (int x = 0; x <= size; x++) {
+            glm::vec2 uv = glm::vec2(x, y) / (float)size;
+            glm::vec2 p = (uv - 0.5f) * 12.0f;
+            float height = 0.6f * sin(p.x * 1.7f) * cos(p.y * 1.3f);
+            glm::vec3 normal = glm::normalize(glm::vec3(-0.6f * 1.7f * cos(p.x * 1.7f) * cos(p.y * 1.3f), 1.0f, 0.6f * 1.3f * sin(p.x * 1.7f) * sin(p.y * 1.3f)));
+            vertices.push_back({ glm::vec3(p.x, height - 2.0f, p.y - 2.0f), normal, uv });
+        }
+    }
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            uint32_t a = y * (size + 1) + x, b = a + size + 1;
+            indices.insert(indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+        }
+    }
+    scene.meshes.emplace_back(new MyPBRT::Mesh(vertices, indices));
+    scene.objects.push_back(MyPBRT::Object(0, 0));
+    scene.Build();
+}
+
+//spheres that all have a material of their own, a mix of every kind with constant, procedural and image textures
+static void generateMaterials(MyPBRT::Scene& scene)
+{
+    std::vector<uint8_t> pixels(64 * 64 * 3);
+    for (size_t i = 0; i < pixels.size(); i++) {
+        pixels[i] = (uint8_t)((i * 2654435761u) >> 24);
+    }
+    std::shared_ptr<MyPBRT::Texture> image(new MyPBRT::ImageTexture(pixels, 64, 64, 3));
+    std::shared_ptr<MyPBRT::Texture> checkerboard(new MyPBRT::CheckerboardTexture(8));
+
+    scene.lights.emplace_back(new MyPBRT::SphericalLight(glm::vec3(1), 100, glm::vec3(2, 6, 4), .5f));
+    for (int y = 0; y < 16; y++) {
+        for (int x = 0; x < 16; x++) {
+            int i = x + y * 16;
+            glm::vec3 color = glm::vec3((i * 37) % 100, (i * 59) % 100, (i * 83) % 100) * 0.01f;
+            std::shared_ptr<MyPBRT::Texture> constant(new MyPBRT::ConstantTexture<glm::vec3>(color));
+            std::shared_ptr<MyPBRT::Texture> textures[] = { constant, checkerboard, image };
+            switch (i % 8) {
+            case 0: case 1: case 2:
+                scene.materials.emplace_back(new MyPBRT::DiffuseMaterial(textures[i % 3], 0.5f + (i % 5) * 0.1f));
+                break;
+            case 3: case 4:
+                scene.materials.emplace_back(new MyPBRT::MetallicMaterial(textures[(i / 8) % 3], (i % 4) * 0.25f));
+                break;
+            case 5:
+                scene.materials.emplace_back(new MyPBRT::GlassMaterial(std::shared_ptr<MyPBRT::Texture>(new MyPBRT::ConstantTexture<float>((i % 3) * 0.3f)), 1.5f));
+                break;
+            case 6:
+                scene.materials.emplace_back(new MyPBRT::DiffuseMaterial(textures[(i / 8) % 3], 1.0f));
+                break;
+            default:
+                scene.materials.emplace_back(new MyPBRT::EmissiveMaterial(constant, glm::vec3(2.0f)));
+                break;
+            }
+
+            std::vector<uint32_t> indices;
+            std::vector<MyPBRT::Mesh::Vertex> vertices = uvSphere(12, 6, indices);
+            for (auto& vertex : vertices) {
+                vertex.position = vertex.position * 0.22f + glm::vec3(x - 7.5f, y - 7.5f, -2.0f) * 0.5f;
+            }
+            scene.meshes.emplace_back(new MyPBRT::Mesh(vertices, indices));
+            scene.objects.push_back(MyPBRT::Object(scene.meshes.size() - 1, i));
+        }
+    }
+    scene.Build();
+}
+
+//the triangle heightfield as an obj file, written once into the temp folder
+static std::filesystem::path generateObj()
+{
+    const int size = 512;
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "myPbrt_generated_triangles.obj";
+    std::ofstream file(path);
+    file << "# generated by myPbrt_benchmark\n";
+    for (int y = 0; y <= size; y++) {
+        for (int x = 0; x <= size; x++) {
+            glm::vec2 uv = glm::vec2(x, y) / (float)size;
+            glm::vec2 p = (uv - 0.5f) * 12.0f;
+            float height = 0.6f * sin(p.x * 1.7f) * cos(p.y * 1.3f);
+            glm::vec3 normal = glm::normalize(glm::vec3(-0.6f * 1.7f * cos(p.x * 1.7f) * cos(p.y * 1.3f), 1.0f, 0.6f * 1.3f * sin(p.x * 1.7f) * sin(p.y * 1.3f)));
+            file << "v " << p.x << " " << height << " " << p.y << "\n";
+            file << "vt " << uv.x << " " << uv.y << "\n";
+            file << "vn " << normal.x << " " << normal.y << " " << normal.z << "\n";
+        }
+    }
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            uint32_t a = y * (size + 1) + x + 1, b = a + size + 1;
+            file << "f " << a << "/" << a << "/" << a << " " << b << "/" << b << "/" << b << " " << b + 1 << "/" << b + 1 << "/" << b + 1 << " " << a + 1 << "/" << a + 1 << "/" << a + 1 << "\n";
+        }
+    }
+    return path;
+}
+
+//import speed of the obj loader the editor used to use against ours
+static Json::Value benchmarkObj(const std::filesystem::path& path, const Options& options)
+{
+    double megabytes = std::filesystem::file_size(path) / (1024.0 * 1024.0);
+    double objl_time = std::numeric_limits<double>::max(), our_time = std::numeric_limits<double>::max();
+    size_t objl_triangles = 0, our_triangles = 0;
+    for (int r = 0; r < options.repeat; r++) {
+        objl::Loader loader;
+        auto start = Clock::now();
+        loader.LoadFile(path.string());
+        objl_time = std::min(objl_time, seconds(start));
+        objl_triangles = loader.LoadedIndices.size() / 3;
+
+        MyPBRT::Mesh::Geometry geometry;
+        start = Clock::now();
+        MyPBRT::ObjFile::Load(path.string(), geometry);
+        our_time = std::min(our_time, seconds(start));
+        our_triangles = geometry.index_count / 3;
+    }
+
+    Json::Value result;
+    result["name"] = path.filename().string();
+    result["megabytes"] = megabytes;
+    result["objl"]["seconds"] = objl_time;
+    result["objl"]["megabytes_per_second"] = megabytes / objl_time;
+    result["objl"]["triangles"] = (Json::UInt64)objl_triangles;
+    result["mypbrt"]["seconds"] = our_time;
+    result["mypbrt"]["megabytes_per_second"] = megabytes / our_time;
+    result["mypbrt"]["triangles"] = (Json::UInt64)our_triangles;
+    std::cout << path.filename().string() << ": " << megabytes << " MB, objl " << megabytes / objl_time << " MB/s, ours " << megabytes / our_time << " MB/s\n";
+    return result;
+}
+
+static bool loadScene(const std::filesystem::path& folder, MyPBRT::Scene& scene)
+{
+    std::ifstream inFile(folder / "data.json");
+    Json::CharReaderBuilder reader;
+    Json::Value root;
+    std::string errors;
+    if (!Json::parseFromStream(reader, inFile, &root, &errors)) {
+        std::cerr << "couldn't parse " << (folder / "data.json").string() << ": " << errors << "\n";
+        return false;
+    }
+    scene.Load(folder.string(), root);
+    return true;
+}
+
+//runs fn(begin, end) over [0, count) in parallel chunks, returns the best time of all repeats
+template <typename F>
+static double timeParallel(size_t count, int repeat, F&& fn)
+{
+    const size_t chunk_size = 256;
+    std::vector<size_t> chunks((count + chunk_size - 1) / chunk_size);
+    std::iota(chunks.begin(), chunks.end(), 0);
+
+    double best = std::numeric_limits<double>::max();
+    for (int r = 0; r < repeat; r++) {
+        auto start = Clock::now();
+        std::for_each(std::execution::par, chunks.begin(), chunks.end(), [&](size_t chunk) {
+            fn(chunk * chunk_size, std::min((chunk + 1) * chunk_size, count));
+            });
+        best = std::min(best, seconds(start));
+    }
+    return best;
+}
+
+static Json::Value throughput(size_t rays, double time)
+{
+    Json::Value node;
+    node["rays"] = (Json::UInt64)rays;
+    node["seconds"] = time;
+    node["mrays_per_second"] = time > 0 ? rays / time * 1e-6 : 0.0;
+    return node;
+}
+
+//the layout ImageTexture used to have, channels interleaved row by row, filtered the same way
+class RowMajorTexture : public MyPBRT::Texture {
+public:
+    RowMajorTexture(const std::vector<uint8_t>& _pixels, uint32_t _width, uint32_t _height, uint8_t _channels)
+        : pixels(_pixels), width(_width), height(_height), channels(_channels) {}
+
+    glm::vec4 Evaluate(const MyPBRT::SurfaceInteraction& interaction) const override
+    {
+        glm::vec2 uv(glm::clamp(interaction.uv.x, 0.0f, 1.0f), 1.0f - glm::clamp(interaction.uv.y, 0.0f, 1.0f));
+        float x = uv.x * width - 0.5f, y = uv.y * height - 0.5f;
+        float fx = floor(x), fy = floor(y);
+        int x0 = glm::clamp((int)fx, 0, (int)width - 1), x1 = glm::clamp((int)fx + 1, 0, (int)width - 1);
+        int y0 = glm::clamp((int)fy, 0, (int)height - 1), y1 = glm::clamp((int)fy + 1, 0, (int)height - 1);
+        glm::vec4 top = glm::mix(Texel(x0, y0), Texel(x1, y0), x - fx);
+        glm::vec4 bottom = glm::mix(Texel(x0, y1), Texel(x1, y1), x - fx);
+        glm::vec4 val = glm::mix(top, bottom, y - fy) * (1.0f / 255.0f);
+        if (channels < 4) {
+            val.w = 1;
+        }
+        return val;
+    }
+
+private:
+    glm::vec4 Texel(int x, int y) const
+    {
+        glm::vec4 val(0);
+        for (int c = 0; c < channels; c++) {
+            val[c] = pixels[((size_t)y * width + x) * channels + c];
+        }
+        return val;
+    }
+
+    std::vector<uint8_t> pixels;
+    uint32_t width;
+    uint32_t height;
+    uint8_t channels;
+};
+
+//lookups at random uvs into a large texture, the tiled layout of ImageTexture against the row major one it used to have
+static Json::Value benchmarkTexture(const Options& options)
+{
+    const uint32_t size = 4096;
+    const uint8_t channels = 3;
+    std::vector<uint8_t> pixels((size_t)size * size * channels);
+    for (size_t i = 0; i < pixels.size(); i++) {
+        pixels[i] = (uint8_t)((i * 2654435761u) >> 24);
+    }
+    MyPBRT::ImageTexture texture(pixels, size, size, channels);
+
+    const size_t count = 1 << 22;
+    std::vector<glm::vec2> uvs(count);
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+    for (auto& uv : uvs) {
+        uv = glm::vec2(distribution(rng), distribution(rng));
+    }
+    std::vector<float> results(count);
+
+    RowMajorTexture row_major(pixels, size, size, channels);
+    double row_major_time = timeParallel(count, options.repeat, [&](size_t begin, size_t end) {
+        MyPBRT::SurfaceInteraction interaction;
+        for (size_t i = begin; i < end; i++) {
+            interaction.uv = uvs[i];
+            results[i] = row_major.Evaluate(interaction).x;
+        }
+        });
+    double tiled_time = timeParallel(count, options.repeat, [&](size_t begin, size_t end) {
+        MyPBRT::SurfaceInteraction interaction;
+        for (size_t i = begin; i < end; i++) {
+            interaction.uv = uvs[i];
+            results[i] = texture.Evaluate(interaction).x;
+        }
+        });
+
+    Json::Value result;
+    result["size"] = size;
+    result["channels"] = channels;
+    result["lookups"] = (Json::UInt64)count;
+    result["row_major"]["seconds"] = row_major_time;
+    result["row_major"]["mlookups_per_second"] = count / row_major_time * 1e-6;
+    result["tiled"]["seconds"] = tiled_time;
+    result["tiled"]["mlookups_per_second"] = count / tiled_time * 1e-6;
+    std::cout << "texture " << size << "x" << size << ": row major " << count / row_major_time * 1e-6 << " Mlookups/s, tiled " << count / tiled_time * 1e-6 << " Mlookups/s\n";
+    return result;
+}
+
+static Json::Value benchmarkRays(const MyPBRT::Scene& scene, const MyPBRT::Camera& camera, const Options& options)
+{
+    Json::Value result;
+    const glm::ivec2 res = options.resolution;
+
+    std::vector<MyPBRT::Ray> primary(res.x * res.y);
+    for (int y = 0; y < res.y; y++) {
+        for (int x = 0; x < res.x; x++) {
+            primary[x + y * res.x] = camera.GetRay(glm::ivec2(x, y));
+        }
+    }
+
+    std::vector<MyPBRT::SurfaceInteraction> hits(primary.size());
+    std::vector<char> hit(primary.size());
+    double time = timeParallel(primary.size(), options.repeat, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            MyPBRT::Ray ray = primary[i];
+            hits[i] = MyPBRT::SurfaceInteraction();
+            hit[i] = scene.IntersectAccel(ray, &hits[i]);
+        }
+        });
+    result["primary"] = throughput(primary.size(), time);
+
+    //secondary rays start on the surfaces the camera sees
+    std::vector<MyPBRT::Ray> shadow;
+    std::vector<MyPBRT::Ray> incoherent;
+    for (size_t i = 0; i < primary.size(); i++) {
+        if (!hit[i]) continue;
+        MyPBRT::SurfaceInteraction& interaction = hits[i];
+        glm::vec3 normal = glm::dot(interaction.normal, primary[i].d) > 0 ? -interaction.normal : interaction.normal;
+        glm::vec3 origin = interaction.pos + normal * 0.0001f;
+
+        MyPBRT::seed_random((uint32_t)i, 0);
+        glm::vec3 target = scene.lights.size() > 0 ? scene.lights[i % scene.lights.size()]->Sample(interaction) : origin + glm::vec3(0.3f, 1.0f, 0.2f) * 100.0f;
+        shadow.emplace_back(origin, target - origin, 1.0f);
+
+        glm::vec3 a = fabs(normal.x) > 0.9f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0);
+        glm::vec3 v = glm::normalize(glm::cross(normal, a));
+        glm::vec3 u = glm::cross(normal, v);
+        glm::vec3 local = MyPBRT::random_cosine_direction();
+        incoherent.emplace_back(origin, local.x * u + local.y * v + local.z * normal);
+    }
+
+    std::vector<char> occluded(shadow.size());
+    time = timeParallel(shadow.size(), options.repeat, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            occluded[i] = scene.hasIntersectionsAccel(shadow[i]);
+        }
+        });
+    result["shadow"] = throughput(shadow.size(), time);
+
+    time = timeParallel(incoherent.size(), options.repeat, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            MyPBRT::Ray ray = incoherent[i];
+            MyPBRT::SurfaceInteraction interaction;
+            scene.IntersectAccel(ray, &interaction);
+        }
+        });
+    result["incoherent"] = throughput(incoherent.size(), time);
+
+    result["primary"]["hit_fraction"] = primary.size() ? (double)shadow.size() / primary.size() : 0.0;
+    result["shadow"]["occluded_fraction"] = shadow.size() ? (double)std::count(occluded.begin(), occluded.end(), 1) / shadow.size() : 0.0;
+    return result;
+}
+
+static Json::Value benchmarkFrame(const MyPBRT::Scene& scene, const MyPBRT::Camera& camera, const Options& options, int threads, bool sort_by_material = false)
+{
+#ifdef MYPBRT_HAS_TBB
+    std::unique_ptr<tbb::global_control> control;
+    if (threads > 0) {
+        control.reset(new tbb::global_control(tbb::global_control::max_allowed_parallelism, threads));
+    }
+#endif
+
+    MyPBRT::Integrator integrator(8, options.resolution, glm::vec2(1));
+    integrator.target_samples = options.frame_samples;
+    integrator.sort_by_material = sort_by_material;
+
+    double best = std::numeric_limits<double>::max();
+    uint64_t rays = 0;
+    for (int r = 0; r < options.repeat; r++) {
+        integrator.ResetFrameIndex();
+        auto start = Clock::now();
+        while (!integrator.Finished()) {
+            integrator.Render(scene, camera);
+        }
+        double time = seconds(start);
+        if (time < best) {
+            best = time;
+            rays = integrator.GetRayCount();
+        }
+    }
+
+    Json::Value result = throughput(rays, best);
+    result["threads"] = threads > 0 ? threads : (int)std::thread::hardware_concurrency();
+    result["samples"] = options.frame_samples;
+    result["ms_per_sample"] = best * 1000.0 / options.frame_samples;
+    return result;
+}
+
+static Json::Value benchmarkScene(const std::string& name, MyPBRT::Scene& scene, const Options& options)
+{
+    MyPBRT::Camera camera(50, 0.01, 100, 0, 0);
+    camera.OnResize(options.resolution);
+    camera.Update(0);
+    scene.Preprocess();
+
+    size_t triangles = 0;
+    for (auto& object : scene.objects) {
+        triangles += scene.meshes[object.shape]->GetGeometry().index_count / 3;
+    }
+
+    std::cout << name << ": " << scene.objects.size() << " objects, " << triangles << " triangles\n";
+
+    Json::Value result;
+    result["name"] = name;
+    result["objects"] = (Json::UInt64)scene.objects.size();
+    result["triangles"] = (Json::UInt64)triangles;
+    result["rays"] = benchmarkRays(scene, camera, options);
+    for (auto& kind : { "primary", "shadow", "incoherent" }) {
+        std::cout << "  " << kind << " " << result["rays"][kind]["mrays_per_second"].asDouble() << " Mrays/s\n";
+    }
+
+#ifdef MYPBRT_HAS_TBB
+    std::vector<int> thread_counts = { 1, 2, 4, 0 };
+#else
+    //without tbb the thread count of std::execution::par can't be limited
+    std::vector<int> thread_counts = { 0 };
+#endif
+    for (int threads : thread_counts) {
+        Json::Value frame = benchmarkFrame(scene, camera, options, threads);
+        std::cout << "  frame, " << frame["threads"].asInt() << " threads: " << frame["ms_per_sample"].asDouble() << " ms/spp, " << frame["mrays_per_second"].asDouble() << " Mrays/s\n";
+        result["frame"].append(frame);
+    }
+    Json::Value sorted = benchmarkFrame(scene, camera, options, 0, true);
+    std::cout << "  frame sorted by material: " << sorted["ms_per_sample"].asDouble() << " ms/spp, " << sorted["mrays_per_second"].asDouble() << " Mrays/s\n";
+    result["frame_sorted_by_material"] = sorted;
+    return result;
+}
+
+//evaluates and scatters at the hits of the generated materials scene, through the virtual materials the integrator used to call
+//against the material table in hit order and sorted by material
+//the hits are shuffled the way the hits of later bounces are, neighbouring paths rarely hit the same material there
+static Json::Value benchmarkShading(const Options& options)
+{
+    MyPBRT::Scene scene;
+    generateMaterials(scene);
+    scene.Preprocess();
+    MyPBRT::Camera camera(50, 0.01, 100, 0, 0);
+    camera.OnResize(options.resolution);
+    camera.Update(0);
+
+    std::vector<MyPBRT::SurfaceInteraction> hits;
+    std::vector<glm::vec3> directions;
+    for (int y = 0; y < options.resolution.y; y++) {
+        for (int x = 0; x < options.resolution.x; x++) {
+            MyPBRT::Ray ray = camera.GetRay(glm::ivec2(x, y));
+            MyPBRT::SurfaceInteraction interaction;
+            if (scene.IntersectAccel(ray, &interaction)) {
+                hits.push_back(interaction);
+                directions.push_back(ray.d);
+            }
+        }
+    }
+    std::vector<uint32_t> order(hits.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), std::mt19937(1));
+
+    auto material_of = [&](uint32_t hit) { return scene.objects[hits[hit].primitive].material; };
+    std::vector<uint32_t> sorted = order;
+    std::stable_sort(sorted.begin(), sorted.end(), [&](uint32_t a, uint32_t b) { return material_of(a) < material_of(b); });
+
+    //what a bounce asks of the material, every hit draws the same random numbers in all three runs
+    std::vector<float> results(hits.size());
+    auto shade = [&](const std::vector<uint32_t>& hit_order, auto&& evaluate) {
+        return timeParallel(hit_order.size(), options.repeat, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                uint32_t hit = hit_order[i];
+                MyPBRT::seed_random(hit, 0);
+                results[hit] = evaluate(hits[hit], directions[hit], material_of(hit));
+            }
+            });
+    };
+    double virtual_time = shade(order, [&](MyPBRT::SurfaceInteraction& interaction, glm::vec3 dir, int index) {
+        const std::shared_ptr<MyPBRT::Material>& material = scene.materials[index];
+        glm::vec3 color = material->EvaluateLight(interaction) + material->Evaluate(&interaction);
+        bool has_pdf = false;
+        material->ScatterRay(interaction, dir, has_pdf);
+        return color.x + dir.x + material->Pdf_Value(dir, interaction.normal);
+    });
+    auto table = [&](MyPBRT::SurfaceInteraction& interaction, glm::vec3 dir, int index) {
+        const MyPBRT::MaterialRecord& material = scene.material_table[index];
+        glm::vec3 color = material.EvaluateLight(interaction) + material.Evaluate(interaction);
+        bool has_pdf = false;
+        material.ScatterRay(interaction, dir, has_pdf);
+        return color.x + dir.x + material.Pdf_Value(dir, interaction.normal);
+    };
+    double table_time = shade(order, table);
+    double sorted_time = shade(sorted, table);
+
+    Json::Value result;
+    result["materials"] = (Json::UInt64)scene.materials.size();
+    result["hits"] = (Json::UInt64)hits.size();
+    for (auto [name, time] : { std::make_pair("virtual", virtual_time), std::make_pair("table", table_time), std::make_pair("table_sorted", sorted_time) }) {
+        result[name]["seconds"] = time;
+        result[name]["mhits_per_second"] = hits.size() / time * 1e-6;
+    }
+    std::cout << "shading " << hits.size() << " hits, " << scene.materials.size() << " materials: virtual " << hits.size() / virtual_time * 1e-6
+        << " Mhits/s, table " << hits.size() / table_time * 1e-6 << " Mhits/s, table sorted " << hits.size() / sorted_time * 1e-6 << " Mhits/s\n";
+    return result;
+}
+
+static void printUsage()
+{
+    std::cout <<
+        "usage: myPbrt_benchmark [options]\n"
+        "  --root <dir>              folder containing scenes/ (default .)\n"
+        "  --output <file>           write the results as json\n"
+        "  --scene <name>            only run scenes whose name contains this\n"
+        "  --width <n> --height <n>  ray and frame resolution (default 256x256)\n"
+        "  --repeat <n>              runs per measurement, the best is reported (default 3)\n"
+        "  --samples <n>             samples per pixel of the full frame renders (default 4)\n"
+        "  --no-generated            skip the generated stress scenes and obj file\n"
+        "  --no-obj                  skip the obj import measurements\n"
+        "  --no-texture              skip the texture lookup measurements\n"
+        "  --no-shading              skip the material shading measurements\n";
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--no-generated") options.generated = false;
+        else if (arg == "--no-obj") options.obj = false;
+        else if (arg == "--no-texture") options.texture = false;
+        else if (arg == "--no-shading") options.shading = false;
+        else if (arg == "--root" && has_value) options.root = argv[++i];
+        else if (arg == "--output" && has_value) options.output = argv[++i];
+        else if (arg == "--scene" && has_value) options.filter = argv[++i];
+        else if (arg == "--width" && has_value) options.resolution.x = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--height" && has_value) options.resolution.y = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--repeat" && has_value) options.repeat = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--samples" && has_value) options.frame_samples = std::max(1, std::stoi(argv[++i]));
+        else {
+            printUsage();
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        }
+    }
+
+    std::vector<std::filesystem::path> folders;
+    std::filesystem::path scenes_folder = std::filesystem::path(options.root) / "scenes";
+    if (std::filesystem::is_directory(scenes_folder)) {
+        for (auto& entry : std::filesystem::directory_iterator(scenes_folder)) {
+            if (std::filesystem::exists(entry.path() / "data.json")) {
+                folders.push_back(entry.path());
+            }
+        }
+    }
+    std::sort(folders.begin(), folders.end());
+
+    Json::Value root;
+    root["resolution"].append(options.resolution.x);
+    root["resolution"].append(options.resolution.y);
+    root["repeat"] = options.repeat;
+    root["hardware_threads"] = (int)std::thread::hardware_concurrency();
+
+    auto matches = [&](const std::string& name) { return options.filter.empty() || name.find(options.filter) != std::string::npos; };
+
+    for (auto& folder : folders) {
+        std::string name = folder.filename().string();
+        if (!matches(name)) continue;
+        MyPBRT::Scene scene;
+        if (!loadScene(folder, scene)) continue;
+        root["scenes"].append(benchmarkScene(name, scene, options));
+    }
+
+    if (options.generated) {
+        std::pair<const char*, void(*)(MyPBRT::Scene&)> generators[] = {
+            { "generated_instances", generateInstances },
+            { "generated_triangles", generateTriangles },
+            { "generated_materials", generateMaterials },
+        };
+        for (auto& [name, generate] : generators) {
+            if (!matches(name)) continue;
+            MyPBRT::Scene scene;
+            generate(scene);
+            root["scenes"].append(benchmarkScene(name, scene, options));
+        }
+    }
+
+    if (options.obj) {
+        std::vector<std::filesystem::path> models;
+        std::filesystem::path models_folder = std::filesystem::path(options.root) / "models";
+        if (std::filesystem::is_directory(models_folder)) {
+            for (auto& entry : std::filesystem::directory_iterator(models_folder)) {
+                if (entry.path().extension() == ".obj" && matches(entry.path().stem().string())) {
+                    models.push_back(entry.path());
+                }
+            }
+        }
+        std::sort(models.begin(), models.end());
+        if (options.generated && matches("generated_triangles")) {
+            models.push_back(generateObj());
+        }
+        for (auto& model : models) {
+            root["obj_import"].append(benchmarkObj(model, options));
+        }
+    }
+
+    if (options.texture && matches("texture")) {
+        root["texture_lookups"] = benchmarkTexture(options);
+    }
+
+    if (options.shading && matches("shading")) {
+        root["shading"] = benchmarkShading(options);
+    }
+
+    Json::StreamWriterBuilder writer;
+    std::string json = Json::writeString(writer, root);
+    if (options.output.empty()) {
+        std::cout << json << "\n";
+    }
+    else {
+        std::ofstream outFile(options.output);
+        outFile << json << "\n";
+        std::cout << "saved " << options.output << "\n";
+    }
+
+    return 0;
+}
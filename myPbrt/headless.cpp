@@ -0,0 +1,300 @@
+#include <core/core.h>
+#include <core/Camera.h>
+#include <core/Integrator.h>
+#include <core/Scene.h>
+#include <core/Object.h>
+#include <core/Material.h>
+#include <core/Mesh.h>
+#include <core/Light.h>
+#include <core/Distributed.h>
+#include <core/Trace.h>
+#include <core/TextureCache.h>
+
+#include <json/json.h>
+#include <fstream>
+#include <chrono>
+#include <cstring>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image/stb_image_write.h>
+
+//renders a saved scene without a window, ex.
+//myPbrt_headless --scene test --spp 256 --width 1280 --height 720 --output images/test.png
+
+struct Options {
+    std::string scene = "";
+    std::string root = ".";
+    std::string output = "images/out.png";
+    uint32_t spp = 64;
+    double time = 0;
+    float noise = 0;
+    glm::ivec2 resolution = { 1200, 720 };
+    uint32_t bounces = 8;
+    bool has_camera = false;
+    glm::vec3 camera_position = glm::vec3(0, 0, 10);
+    glm::vec3 camera_direction = glm::vec3(0, 0, -1);
+    float fov = 50;
+    float focal_distance = 0;
+    float lens_radius = 0;
+    float exposure = 0;
+    MyPBRT::Integrator::ToneMapping tone_mapping = MyPBRT::Integrator::ToneMapping::None;
+    bool denoise = false;
+    bool sort_by_material = false;
+    bool quiet = false;
+    std::string coordinator = "";
+    std::string worker = "";
+    std::string trace = "";
+    int tile_size = 64;
+    uint32_t job_samples = 0;
+    size_t texture_budget = 0;
+    std::string environment = "";
+};
+
+void printUsage()
+{
+    std::cout <<
+        "usage: myPbrt_headless --scene <name> [options]\n"
+        "  --root <dir>              folder containing scenes/ (default .)\n"
+        "  --spp <n>                 samples per pixel (default 64)\n"
+        "  --time <seconds>          stop once the time runs out, spp stays the upper limit\n"
+        "  --noise <threshold>       stop once the estimated relative noise drops below the threshold\n"
+        "  --width <n> --height <n>  output resolution\n"
+        "  --bounces <n>\n"
+        "  --camera px py pz dx dy dz\n"
+        "  --fov <degrees> --focal-distance <d> --lens-radius <r>\n"
+        "  --exposure <stops> --tonemap none|reinhard|aces\n"
+        "  --denoise\n"
+        "  --sort-materials          shade a bounce of all paths at once, grouped by material\n"
+        "  --output <file>           .png is tonemapped, .pfm is linear float\n"
+        "  --quiet\n"
+        "  --trace <file>            write a chrome trace of the run, open it in ui.perfetto.dev\n"
+        "  --texture-budget <mb>     read images through the texture cache, keeping at most this much of them in memory\n"
+        "  --environment <image>     image in textures/ used as the world texture, equirectangular\n"
+        "distributed rendering, addresses are host:port or unix:/path/to/socket:\n"
+        "  --coordinator <address>   render the scene with workers connecting to address, --time is ignored\n"
+        "  --tile-size <n>           pixels per side of a job (default 64)\n"
+        "  --job-samples <n>         samples per job, 0 for all of them (default)\n"
+        "  --worker <address>        render jobs of the coordinator at address, needs no scene\n";
+}
+
+bool parseArgs(int argc, char** argv, Options& options)
+{
+    auto next = [&](int& i) -> const char* {
+        if (i + 1 >= argc) {
+            std::cerr << "missing value for " << argv[i] << "\n";
+            return nullptr;
+        }
+        return argv[++i];
+    };
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        const char* value = nullptr;
+        if (arg == "--help" || arg == "-h") {
+            return false;
+        }
+        else if (arg == "--denoise") {
+            options.denoise = true;
+        }
+        else if (arg == "--sort-materials") {
+            options.sort_by_material = true;
+        }
+        else if (arg == "--quiet") {
+            options.quiet = true;
+        }
+        else if (arg == "--camera") {
+            if (i + 6 >= argc) {
+                std::cerr << "--camera needs 6 values\n";
+                return false;
+            }
+            for (int j = 0; j < 3; j++) options.camera_position[j] = std::stof(argv[++i]);
+            for (int j = 0; j < 3; j++) options.camera_direction[j] = std::stof(argv[++i]);
+            options.has_camera = true;
+        }
+        else if (!(value = next(i))) {
+            return false;
+        }
+        else if (arg == "--scene") options.scene = value;
+        else if (arg == "--root") options.root = value;
+        else if (arg == "--output" || arg == "-o") options.output = value;
+        else if (arg == "--spp") options.spp = std::max(1, std::stoi(value));
+        else if (arg == "--time") options.time = std::stod(value);
+        else if (arg == "--noise") options.noise = std::stof(value);
+        else if (arg == "--width") options.resolution.x = std::max(1, std::stoi(value));
+        else if (arg == "--height") options.resolution.y = std::max(1, std::stoi(value));
+        else if (arg == "--bounces") options.bounces = std::max(1, std::stoi(value));
+        else if (arg == "--fov") options.fov = std::stof(value);
+        else if (arg == "--focal-distance") options.focal_distance = std::stof(value);
+        else if (arg == "--lens-radius") options.lens_radius = std::stof(value);
+        else if (arg == "--exposure") options.exposure = std::stof(value);
+        else if (arg == "--coordinator") options.coordinator = value;
+        else if (arg == "--worker") options.worker = value;
+        else if (arg == "--trace") options.trace = value;
+        else if (arg == "--tile-size") options.tile_size = std::max(1, std::stoi(value));
+        else if (arg == "--job-samples") options.job_samples = std::max(0, std::stoi(value));
+        else if (arg == "--texture-budget") options.texture_budget = (size_t)std::max(0, std::stoi(value)) << 20;
+        else if (arg == "--environment") options.environment = value;
+        else if (arg == "--tonemap") {
+            std::string mode = value;
+            if (mode == "none") options.tone_mapping = MyPBRT::Integrator::ToneMapping::None;
+            else if (mode == "reinhard") options.tone_mapping = MyPBRT::Integrator::ToneMapping::Reinhard;
+            else if (mode == "aces") options.tone_mapping = MyPBRT::Integrator::ToneMapping::ACES;
+            else {
+                std::cerr << "unknown tone mapping " << mode << "\n";
+                return false;
+            }
+        }
+        else {
+            std::cerr << "unknown argument " << arg << "\n";
+            return false;
+        }
+    }
+
+    if (options.scene.empty() && options.worker.empty()) {
+        std::cerr << "no scene given\n";
+        return false;
+    }
+    return true;
+}
+
+bool loadScene(const Options& options, MyPBRT::Scene& scene)
+{
+    std::string folder = options.root + "/scenes/" + options.scene;
+    std::ifstream inFile(folder + "/data.json");
+    if (!inFile.is_open()) {
+        std::cerr << "couldn't open " << folder << "/data.json\n";
+        return false;
+    }
+
+    Json::CharReaderBuilder reader;
+    Json::Value root;
+    std::string errors;
+    if (!Json::parseFromStream(reader, inFile, &root, &errors)) {
+        std::cerr << "couldn't parse " << folder << "/data.json: " << errors << "\n";
+        return false;
+    }
+    scene.Load(folder, root);
+    return true;
+}
+
+bool endsWith(const std::string& str, const std::string& suffix)
+{
+    return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool writeImage(const Options& options, MyPBRT::Integrator& integrator)
+{
+    glm::ivec2 res = integrator.ScaledResolution();
+
+    if (endsWith(options.output, ".pfm")) {
+        //little endian rgb, rows go bottom to top just like the framebuffer
+        std::vector<glm::vec3> radiance = integrator.GetRadiance();
+        std::ofstream outFile(options.output, std::ios::binary);
+        if (!outFile.is_open()) return false;
+        outFile << "PF\n" << res.x << " " << res.y << "\n-1.0\n";
+        outFile.write((const char*)radiance.data(), radiance.size() * sizeof(glm::vec3));
+        return outFile.good();
+    }
+
+    stbi_flip_vertically_on_write(1);
+    return stbi_write_png(options.output.c_str(), res.x, res.y, 4, integrator.GetImage(false), res.x * 4);
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!parseArgs(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+
+    MyPBRT::Trace::SetThreadName("main");
+    auto dumpTrace = [&]() {
+        if (!options.trace.empty() && !MyPBRT::Trace::Dump(options.trace)) {
+            std::cerr << "couldn't write " << options.trace << "\n";
+        }
+    };
+
+    MyPBRT::TextureCache::memory_budget = options.texture_budget;
+
+    if (!options.worker.empty()) {
+        MyPBRT::RenderWorker worker(options.worker);
+        worker.quiet = options.quiet;
+        bool success = worker.Run();
+        dumpTrace();
+        return success ? 0 : 1;
+    }
+
+    MyPBRT::Scene scene;
+    if (!loadScene(options, scene)) {
+        return 1;
+    }
+
+    MyPBRT::Camera camera(options.fov, 0.01, 100, options.focal_distance, options.lens_radius);
+    if (options.has_camera) {
+        camera.SetPosition(options.camera_position);
+        camera.SetDirection(options.camera_direction);
+    }
+
+    MyPBRT::Integrator integrator(options.bounces, options.resolution, glm::vec2(1));
+    integrator.exposure = options.exposure;
+    integrator.tone_mapping = options.tone_mapping;
+    integrator.denoise = options.denoise;
+    integrator.sort_by_material = options.sort_by_material;
+    integrator.target_samples = options.spp;
+    integrator.time_budget = options.time;
+    integrator.noise_threshold = options.noise;
+    if (!options.environment.empty()) {
+        std::shared_ptr<MyPBRT::Texture> environment = MyPBRT::Texture::LoadImage(options.environment);
+        if (!environment) {
+            std::cerr << "couldn't load " << options.environment << "\n";
+            return 1;
+        }
+        integrator.SetWorldTexture(environment);
+    }
+
+    camera.OnResize(integrator.ScaledResolution());
+    camera.Update(0);
+    scene.Preprocess();
+
+    auto start = std::chrono::high_resolution_clock::now();
+    auto elapsed = [&]() {
+        return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    };
+
+    if (!options.coordinator.empty()) {
+        MyPBRT::RenderCoordinator coordinator(options.coordinator);
+        coordinator.samples = options.spp;
+        coordinator.tile_size = options.tile_size;
+        coordinator.job_samples = options.job_samples;
+        coordinator.quiet = options.quiet;
+        if (!coordinator.Render(scene, camera, integrator)) {
+            return 1;
+        }
+        std::cout << integrator.GetFrameIndex() << " spp in " << elapsed() << " s\n";
+    }
+    else {
+        while (!integrator.Finished()) {
+            integrator.Render(scene, camera);
+            if (!options.quiet) {
+                std::cout << "\rsample " << integrator.GetFrameIndex() << "/" << options.spp << std::flush;
+            }
+        }
+        if (!options.quiet) {
+            std::cout << "\n";
+        }
+        std::cout << integrator.GetReport() << "\n";
+    }
+    if (options.texture_budget > 0) {
+        std::cout << "texture cache: " << MyPBRT::TextureCache::TileLoads() << " tile loads, " << (MyPBRT::TextureCache::ResidentBytes() >> 20) << " MB resident\n";
+    }
+
+    if (!writeImage(options, integrator)) {
+        std::cerr << "couldn't write " << options.output << "\n";
+        return 1;
+    }
+    std::cout << "saved " << options.output << "\n";
+
+    dumpTrace();
+    return 0;
+}
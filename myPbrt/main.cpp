@@ -5,6 +5,7 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <core/App.h>
+#include <core/Trace.h>
 #include <fstream>
 
 #if defined(_MSC_VER) && (_MSC_VER >= 1900) && !defined(IMGUI_DISABLE_WIN32_FUNCTIONS)
@@ -26,6 +27,7 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 void handleInput();
 
 void refreshImage(uint32_t* data, uint32_t width, uint32_t height) {
+    MYPBRT_TRACE_SCOPE("refreshImage");
     static uint32_t image_width = 0, image_height = 0;
 
     glBindTexture(GL_TEXTURE_2D, image);
@@ -50,7 +52,7 @@ MyPBRT::App app;
 
 int main(int, char**)
 {
-    srand(time(NULL));
+    MyPBRT::Trace::SetThreadName("main");
     glfwSetErrorCallback(glfw_error_callback);
     if (!glfwInit())
         return 0;
@@ -115,6 +117,7 @@ int main(int, char**)
         dt = time - lasttime;
         lasttime = time;
 
+        MYPBRT_TRACE_SCOPE("frame");
         glfwPollEvents();
 
         ImGui_ImplOpenGL3_NewFrame();
@@ -150,6 +153,7 @@ int main(int, char**)
 
         ImGui::End();
 
+        MYPBRT_TRACE_SCOPE("ImGui render and swap");
         ImGui::Render();
         int display_w, display_h;
         glfwGetFramebufferSize(window, &display_w, &display_h);
@@ -11,6 +11,7 @@
 #include "Mesh.h"
 
 #include "BVHAccelerator.h"
+#include "Trace.h"
 
 #include <json/json.h>
 #include <fstream>
@@ -40,6 +41,7 @@ namespace MyPBRT {
 
     void App::Update(double dt, glm::ivec2 resolution)
     {
+        MYPBRT_TRACE_SCOPE("App::Update");
         afk_timer += dt;
         if (afk_timer > 1.5) {
             scene.Build();
@@ -48,15 +50,24 @@ namespace MyPBRT {
         integrator.OnResize(resolution);
         camera.OnResize(integrator.ScaledResolution());
         if (camera.Update(dt)) {
-            integrator.ResetFrameIndex();
-            integrator.Clear();
+            integrator.CameraMoved();
         }
         scene.Preprocess();
         integrator.Render(scene, camera);
+
+        bool finished = integrator.Finished();
+        if (finished && !was_finished) {
+            std::cout << integrator.GetReport() << "\n";
+            if (save_when_finished) {
+                SaveRenderedImage(image_save_path.empty() ? "render" : image_save_path);
+            }
+        }
+        was_finished = finished;
     }
 
 	uint32_t* App::GetImage()
 	{
+		MYPBRT_TRACE_SCOPE("App::GetImage");
 		return integrator.GetImage();
 	}
 
@@ -287,6 +298,22 @@ namespace MyPBRT {
         if (ImGui::Button("Save")) {
             SaveRenderedImage(image_save_path);
         }
+        ImGui::Checkbox("save when finished", &save_when_finished);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("save as soon as a render budget is reached");
+        }
+
+        bool tracing = Trace::Enabled();
+        if (ImGui::Checkbox("trace", &tracing)) {
+            Trace::SetEnabled(tracing);
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Dump trace")) {
+            Trace::Dump("images/trace.json");
+        }
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("writes the last frames to images/trace.json, open it in ui.perfetto.dev");
+        }
 
         integrator.CreateIMGUI();
         ImGui::End();
@@ -57,6 +57,9 @@ namespace MyPBRT {
 
 		std::string obj_file_to_load = "";
 		std::string image_save_path = "";
+		//saves the image as soon as the integrator reaches one of its budgets
+		bool save_when_finished = false;
+		bool was_finished = false;
 		std::string scene_foldername = "";
 
 	private:
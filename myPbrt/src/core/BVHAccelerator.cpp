@@ -3,6 +3,7 @@
 #include "Object.h"
 #include "Mesh.h"
 #include "Interaction.h"
+#include "Stats.h"
 
 #include <algorithm>
 
@@ -20,6 +21,11 @@ namespace MyPBRT {
 		uint8_t pad; // 1 byte
 	}; // 32 bytes
 
+	BVHAccelerator::~BVHAccelerator()
+	{
+		delete[] flattenedNodes;
+	}
+
 	BVHAccelerator::Node* BVHAccelerator::Build(const std::vector<Bounds>& objects_bounds)
 	{
 		totalNodes = 0;
@@ -43,6 +49,7 @@ namespace MyPBRT {
 		int offset = 0;
 		Flatten(root, &offset);
 		DestroyTree(root);
+		return nullptr;
 	}
 
 	BVHAccelerator::Node* BVHAccelerator::CreateNode(const std::vector<Bounds>& objects_bounds, std::vector<int>& objectIndexes,  uint32_t start, uint32_t end)
@@ -155,6 +162,7 @@ namespace MyPBRT {
 		if (nodeIndex >= totalNodes) return false;
 
 		FlatNode* node = &flattenedNodes[nodeIndex];
+		MYPBRT_COUNT(BVHNodes);
 		if (!node->bounds.HasIntersections(ray)) return false;
 
 		if (node->nPrimitives > 0) {
@@ -179,6 +187,7 @@ namespace MyPBRT {
 		if (nodeIndex >= totalNodes) return false;
 
 		FlatNode* node = &flattenedNodes[nodeIndex];
+		MYPBRT_COUNT(BVHNodes);
 		if (!node->bounds.HasIntersections(ray)) return false;
 
 		if (node->nPrimitives > 0) {
@@ -201,6 +210,7 @@ namespace MyPBRT {
 		if (nodeIndex >= totalNodes) return false;
 		
 		FlatNode* node = &flattenedNodes[nodeIndex];
+		MYPBRT_COUNT(BVHNodes);
 		if (!node->bounds.HasIntersections(ray)) return false;
 
 		if (node->nPrimitives > 0) {
@@ -38,7 +38,7 @@ namespace MyPBRT {
 
 	public:
 		BVHAccelerator(SplitMethod _splitMethod = SplitMethod::Middle):splitMethod(_splitMethod) {}
-		~BVHAccelerator() { delete[] flattenedNodes; }
+		~BVHAccelerator();
 
 		Node* Build(const std::vector<Bounds>& objects_bounds);
 
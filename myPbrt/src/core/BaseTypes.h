@@ -13,6 +13,9 @@ struct Ray {
     glm::vec3 o;
     glm::vec3 d;
     mutable float tMax;
+    //ray cone used to pick texture mip levels, width at o and how much it grows per unit of distance
+    float cone_width = 0;
+    float cone_spread = 0;
 
     Ray() :o(.0f), d(0,0,-1.0f), tMax(INFINITY) {}
 
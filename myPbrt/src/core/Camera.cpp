@@ -1,6 +1,7 @@
 #include "Camera.h"
 
 #include "BaseTypes.h"
+#include "Trace.h"
 
 namespace MyPBRT {
 
@@ -32,9 +33,10 @@ namespace MyPBRT {
 		}
 
 		if (should_update) {
+			MYPBRT_TRACE_SCOPE("Camera::Recalculate");
 			RecalculateView();
 			RecalculateProjection();
-			RecalculateRayDirections();
+			RecalculateRayBasis();
 			should_update = false;
 			return true;
 		}
@@ -90,7 +92,7 @@ namespace MyPBRT {
 
 	void Camera::MouseMotionCallback(glm::vec2 mouse_position)
 	{
-		right = glm::cross(direction, glm::vec3(.0f, 1.0f, .0f));
+		glm::vec3 pitch_axis = glm::cross(direction, glm::vec3(.0f, 1.0f, .0f));
 		if (last_mouse_position == mouse_position) return;
 		glm::vec2 delta = (mouse_position - last_mouse_position) * 0.007f;
 		last_mouse_position = mouse_position;
@@ -101,7 +103,7 @@ namespace MyPBRT {
 		float pitchDelta = delta.y * .3f;
 		float yawDelta = delta.x * .3f;
 
-		glm::quat q = glm::normalize(glm::cross(glm::angleAxis(-pitchDelta, right), glm::angleAxis(-yawDelta, glm::vec3(.0f, 1.0f, .0f))));
+		glm::quat q = glm::normalize(glm::cross(glm::angleAxis(-pitchDelta, pitch_axis), glm::angleAxis(-yawDelta, glm::vec3(.0f, 1.0f, .0f))));
 		direction = glm::rotate(q, direction);
 
 		should_update = true;
@@ -116,26 +118,40 @@ namespace MyPBRT {
 		should_update = true;
 	}
 
-	const Ray Camera::GetRay(const glm::ivec2& pos) const
+	const Ray Camera::GetRay(const glm::ivec2& pos, const glm::vec2& jitter) const
 	{
-		if (lens_radius == 0) {
-			return Ray(position, rayDirections[pos.x + pos.y * viewportWidth]);
-		}
-		glm::vec2 random_offset = lens_radius * random_in_unit_disk();
-
-		glm::vec3 offset = random_offset.x * right + random_offset.y * glm::vec3(0, 1, 0);
-		glm::vec3 normalized_dir = glm::normalize(rayDirections[pos.x + pos.y * viewportWidth]);
-		glm::vec3 resized_dir = normalized_dir * focal_distance;
-		glm::vec3 dir = glm::normalize(resized_dir - offset);
-		
-		Ray ray(position + offset, dir);
-		
-		return ray;
+		return GenerateRay(glm::vec2(pos) + jitter);
 	}
 
 	const Ray Camera::GetMouseRay(const glm::vec2& pos) const
 	{
-		return GetRay(glm::ivec2(pos.x * viewportWidth, pos.y * viewportHeight));
+		return GenerateRay(glm::vec2(pos.x * viewportWidth, pos.y * viewportHeight));
+	}
+
+	glm::vec3 Camera::GetRayDirection(const glm::ivec2& pos, const glm::vec2& jitter) const
+	{
+		glm::vec2 pixel = glm::vec2(pos) + jitter;
+		return glm::normalize(ray_origin_direction + pixel.x * ray_step_x + pixel.y * ray_step_y);
+	}
+
+	Ray Camera::GenerateRay(const glm::vec2& pixel) const
+	{
+		//unit length along the view direction
+		glm::vec3 dir = ray_origin_direction + pixel.x * ray_step_x + pixel.y * ray_step_y;
+
+		Ray ray(position, glm::normalize(dir));
+		ray.cone_spread = pixel_spread;
+		if (lens_radius == 0) {
+			return ray;
+		}
+
+		//aim from a point on the lens at where the pixel is in focus on the focal plane
+		glm::vec3 random_offset = lens_radius * random_in_unit_disk();
+		glm::vec3 offset = random_offset.x * right + random_offset.y * up;
+
+		ray.o = position + offset;
+		ray.d = glm::normalize(dir * focal_distance - offset);
+		return ray;
 	}
 
 	void Camera::RecalculateProjection()
@@ -150,21 +166,19 @@ namespace MyPBRT {
 		inverseView = glm::inverse(view);
 	}
 
-	void Camera::RecalculateRayDirections()
+	void Camera::RecalculateRayBasis()
 	{
-		rayDirections.resize(viewportWidth * viewportHeight);
-
-		for (uint32_t y = 0; y < viewportHeight; y++) {
-			for (uint32_t x = 0; x < viewportWidth; x++) {
-
-				glm::vec2 coord = { (float)x / (float)viewportWidth, (float)y / (float)viewportHeight };
-				coord = coord * 2.0f - 1.0f; // -1 -> 1
-
-				glm::vec4 target = inverseProjection * glm::normalize(glm::vec4(coord.x, coord.y, 0, 1));
-				glm::vec3 rayDirection = glm::vec3(inverseView * glm::vec4(glm::normalize(glm::vec3(target) / target.w), 0)); // World space
-
-				rayDirections[x + y * viewportWidth] = rayDirection;
-			}
-		}
+		glm::vec3 forward = glm::normalize(direction);
+		right = glm::normalize(glm::cross(forward, glm::vec3(0, 1, 0)));
+		up = glm::cross(right, forward);
+
+		float tan_half_fov = std::tan(glm::radians(verticalFOV) * 0.5f);
+		float aspect = (float)viewportWidth / (float)viewportHeight;
+
+		//raster (0, 0) is the bottom left corner of the image
+		ray_step_x = right * (2.0f * aspect * tan_half_fov / (float)viewportWidth);
+		ray_step_y = up * (2.0f * tan_half_fov / (float)viewportHeight);
+		ray_origin_direction = forward - right * (aspect * tan_half_fov) - up * tan_half_fov;
+		pixel_spread = 2.0f * tan_half_fov / (float)viewportHeight;
 	}
 }
\ No newline at end of file
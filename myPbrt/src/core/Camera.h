@@ -22,7 +22,7 @@ namespace MyPBRT {
 		void MouseMotionCallback(glm::vec2 mouse_position);
 		void ScrollCallback(double offset);
 
-		const glm::ivec2& GetResolution() const { return {viewportWidth, viewportHeight}; }
+		glm::ivec2 GetResolution() const { return {viewportWidth, viewportHeight}; }
 
 		const glm::mat4& GetProjection() const { return projection; }
 		const glm::mat4& GetInverseProjection() const { return inverseProjection; }
@@ -32,17 +32,28 @@ namespace MyPBRT {
 		const glm::vec3 GetPosition() const { return position; }
 		const glm::vec3 GetDirection() const { return direction; }
 
+		void SetPosition(const glm::vec3& _position) { position = _position; should_update = true; }
+		void SetDirection(const glm::vec3& _direction) { direction = glm::normalize(_direction); should_update = true; }
+		void SetVerticalFOV(float _verticalFOV) { verticalFOV = _verticalFOV; should_update = true; }
+
+		float GetVerticalFOV() const { return verticalFOV; }
 		float& GetFocalDistance() { return focal_distance; }
 		float& GetLensRadius() { return lens_radius; }
+		float GetFocalDistance() const { return focal_distance; }
+		float GetLensRadius() const { return lens_radius; }
 
-		const std::vector<glm::vec3>& GetRayDirections() const { return rayDirections; }
-		const Ray GetRay(const glm::ivec2& pos) const;
+		//jitter is the position inside the pixel, (0.5, 0.5) is the center
+		const Ray GetRay(const glm::ivec2& pos, const glm::vec2& jitter = glm::vec2(0.5f)) const;
 		const Ray GetMouseRay(const glm::vec2& pos) const;
+		//normalized direction through the pixel ignoring the lens
+		glm::vec3 GetRayDirection(const glm::ivec2& pos, const glm::vec2& jitter = glm::vec2(0.5f)) const;
 
 	private:
 		void RecalculateProjection();
 		void RecalculateView();
-		void RecalculateRayDirections();
+		void RecalculateRayBasis();
+		//pixel in continuous raster coordinates
+		Ray GenerateRay(const glm::vec2& pixel) const;
 
 	private:
 		glm::mat4 projection{ 1.0f };
@@ -57,14 +68,20 @@ namespace MyPBRT {
 		float focal_distance;
 		float lens_radius;
 
-		glm::vec3 right;
+		glm::vec3 right{ 1.0f, 0.0f, 0.0f };
+		glm::vec3 up{ 0.0f, 1.0f, 0.0f };
+
+		//direction through raster position p is ray_origin_direction + p.x * ray_step_x + p.y * ray_step_y
+		glm::vec3 ray_origin_direction{ 0.0f, 0.0f, -1.0f };
+		glm::vec3 ray_step_x{ 0.0f };
+		glm::vec3 ray_step_y{ 0.0f };
+		//angle a pixel covers, the spread of the ray cones
+		float pixel_spread = 0.0f;
 
 		glm::vec3 position{ 0.0f, 0.0f, 0.0f };
 		glm::vec3 direction{ 0.0f, 0.0f, 0.0f };
 		glm::vec2 velocity{ 0.0f, 0.0f };
 
-		std::vector<glm::vec3> rayDirections;
-
 		glm::vec2 last_mouse_position{ 0.0f, 0.0f };
 
 		uint32_t viewportWidth;
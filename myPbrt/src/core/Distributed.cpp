@@ -0,0 +1,576 @@
+#include "Distributed.h"
+
+#include "Scene.h"
+#include "Object.h"
+#include "Material.h"
+#include "Mesh.h"
+#include "Light.h"
+#include "Texture.h"
+
+#include <json/json.h>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace MyPBRT {
+
+	//every message starts with this, followed by size bytes of payload
+	struct MessageHeader {
+		enum class Type : uint32_t {
+			//scene json size, scene json, file count and for every file of the saved scene folder
+			//its name size, name, size and contents
+			Scene = 1,
+			//JobHeader
+			Job = 2,
+			//JobHeader, color, albedo and normal of the tile
+			Result = 3,
+			Done = 4
+		};
+
+		Type type;
+		uint32_t size;
+	};
+
+	struct JobHeader {
+		uint32_t id;
+		int32_t min_x, min_y, max_x, max_y;
+		uint32_t first_sample;
+		uint32_t sample_count;
+	};
+
+	static int OpenSocket(const std::string& address, bool server)
+	{
+		if (address.rfind("unix:", 0) == 0) {
+			std::string path = address.substr(5);
+			sockaddr_un addr{};
+			if (path.size() >= sizeof(addr.sun_path)) {
+				std::cerr << "socket path too long: " << path << "\n";
+				return -1;
+			}
+			addr.sun_family = AF_UNIX;
+			std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+			int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (fd < 0) return -1;
+			if (server) {
+				unlink(path.c_str());
+				if (bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0 && listen(fd, 64) == 0) return fd;
+			}
+			else if (connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0) {
+				return fd;
+			}
+			close(fd);
+			return -1;
+		}
+
+		size_t colon = address.rfind(':');
+		if (colon == std::string::npos) {
+			std::cerr << "expected host:port or unix:path, got " << address << "\n";
+			return -1;
+		}
+		std::string host = address.substr(0, colon);
+		std::string port = address.substr(colon + 1);
+
+		addrinfo hints{};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = server ? AI_PASSIVE : 0;
+		addrinfo* results = nullptr;
+		if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &results) != 0) {
+			std::cerr << "couldn't resolve " << address << "\n";
+			return -1;
+		}
+
+		int fd = -1;
+		for (addrinfo* info = results; info != nullptr; info = info->ai_next) {
+			fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+			if (fd < 0) continue;
+
+			int yes = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+			if (server) {
+				setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+				if (bind(fd, info->ai_addr, info->ai_addrlen) == 0 && listen(fd, 64) == 0) break;
+			}
+			else if (connect(fd, info->ai_addr, info->ai_addrlen) == 0) {
+				break;
+			}
+			close(fd);
+			fd = -1;
+		}
+		freeaddrinfo(results);
+		return fd;
+	}
+
+	static bool SendAll(int fd, const void* data, size_t size)
+	{
+		const char* bytes = (const char*)data;
+		while (size > 0) {
+			ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+			if (sent <= 0) return false;
+			bytes += sent;
+			size -= sent;
+		}
+		return true;
+	}
+
+	static bool ReceiveAll(int fd, void* data, size_t size)
+	{
+		char* bytes = (char*)data;
+		while (size > 0) {
+			ssize_t received = recv(fd, bytes, size, 0);
+			if (received <= 0) return false;
+			bytes += received;
+			size -= received;
+		}
+		return true;
+	}
+
+	static std::vector<char> CreateMessage(MessageHeader::Type type, const std::vector<const std::vector<char>*>& parts = {})
+	{
+		MessageHeader header{ type, 0 };
+		for (auto part : parts) header.size += (uint32_t)part->size();
+
+		std::vector<char> message(sizeof(header));
+		std::memcpy(message.data(), &header, sizeof(header));
+		for (auto part : parts) message.insert(message.end(), part->begin(), part->end());
+		return message;
+	}
+
+	template <typename T>
+	static void Append(std::vector<char>& buffer, const T* data, size_t count)
+	{
+		buffer.insert(buffer.end(), (const char*)data, (const char*)(data + count));
+	}
+
+	static std::filesystem::path TemporaryFolder()
+	{
+		std::filesystem::path folder = std::filesystem::temp_directory_path() / ("mypbrt_" + std::to_string(getpid()));
+		std::filesystem::create_directories(folder);
+		return folder;
+	}
+
+	//every file below folder, named relative to it
+	static void AppendFolder(std::vector<char>& buffer, const std::filesystem::path& folder)
+	{
+		std::vector<std::filesystem::path> files;
+		for (auto& entry : std::filesystem::recursive_directory_iterator(folder)) {
+			if (entry.is_regular_file()) files.push_back(entry.path());
+		}
+
+		uint32_t count = (uint32_t)files.size();
+		Append(buffer, &count, 1);
+		for (auto& path : files) {
+			std::string name = std::filesystem::relative(path, folder).generic_string();
+			std::ifstream file(path, std::ios::binary);
+			std::vector<char> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+			uint32_t name_size = (uint32_t)name.size();
+			uint64_t size = contents.size();
+			Append(buffer, &name_size, 1);
+			Append(buffer, name.data(), name.size());
+			Append(buffer, &size, 1);
+			Append(buffer, contents.data(), contents.size());
+		}
+	}
+
+	//writes the files of AppendFolder into folder, false if the buffer is cut short or a name leaves the folder
+	static bool ExtractFolder(const char* data, size_t size, const std::filesystem::path& folder)
+	{
+		size_t offset = 0;
+		auto read = [&](void* out, size_t bytes) {
+			if (size - offset < bytes) return false;
+			std::memcpy(out, data + offset, bytes);
+			offset += bytes;
+			return true;
+		};
+
+		uint32_t count;
+		if (!read(&count, sizeof(count))) return false;
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t name_size;
+			if (!read(&name_size, sizeof(name_size)) || size - offset < name_size) return false;
+			std::filesystem::path name = std::filesystem::path(std::string(data + offset, name_size)).lexically_normal();
+			offset += name_size;
+			uint64_t file_size;
+			if (!read(&file_size, sizeof(file_size)) || size - offset < file_size) return false;
+			if (name.is_absolute() || name.empty() || *name.begin() == "..") return false;
+
+			std::filesystem::path path = folder / name;
+			std::filesystem::create_directories(path.parent_path());
+			std::ofstream file(path, std::ios::binary);
+			file.write(data + offset, file_size);
+			offset += file_size;
+		}
+		return true;
+	}
+
+	static Json::Value SerializeVec3(const glm::vec3& v)
+	{
+		Json::Value node;
+		for (int i = 0; i < 3; i++) node.append(v[i]);
+		return node;
+	}
+
+	static glm::vec3 ParseVec3(const Json::Value& node)
+	{
+		return glm::vec3(node[0].asFloat(), node[1].asFloat(), node[2].asFloat());
+	}
+
+	RenderCoordinator::~RenderCoordinator()
+	{
+		for (auto& worker : workers) {
+			close(worker.socket);
+		}
+		if (listen_socket >= 0) {
+			close(listen_socket);
+			if (address.rfind("unix:", 0) == 0) {
+				unlink(address.substr(5).c_str());
+			}
+		}
+	}
+
+	std::vector<char> RenderCoordinator::SerializeScene(const Scene& scene, const Camera& camera, Integrator& integrator) const
+	{
+		//reuses the save format, meshes and textures only go through the disk
+		std::filesystem::path folder = TemporaryFolder();
+		Json::Value root;
+		scene.Save(folder.string(), root["scene"]);
+		if (auto world_texture = integrator.GetWorldTexture().lock()) {
+			root["world texture"] = world_texture->Serialize();
+		}
+
+		std::vector<char> files;
+		AppendFolder(files, folder);
+		std::filesystem::remove_all(folder);
+
+		root["camera"]["position"] = SerializeVec3(camera.GetPosition());
+		root["camera"]["direction"] = SerializeVec3(camera.GetDirection());
+		root["camera"]["fov"] = camera.GetVerticalFOV();
+		root["camera"]["focal distance"] = camera.GetFocalDistance();
+		root["camera"]["lens radius"] = camera.GetLensRadius();
+		root["resolution"].append(integrator.ScaledResolution().x);
+		root["resolution"].append(integrator.ScaledResolution().y);
+		root["bounces"] = integrator.bounces;
+
+		Json::StreamWriterBuilder writer;
+		writer["indentation"] = "";
+		std::string json = Json::writeString(writer, root);
+
+		std::vector<char> payload;
+		uint32_t json_size = (uint32_t)json.size();
+		Append(payload, &json_size, 1);
+		Append(payload, json.data(), json.size());
+		payload.insert(payload.end(), files.begin(), files.end());
+		return CreateMessage(MessageHeader::Type::Scene, { &payload });
+	}
+
+	bool RenderCoordinator::Render(const Scene& scene, const Camera& camera, Integrator& integrator)
+	{
+		if (listen_socket < 0) {
+			listen_socket = OpenSocket(address, true);
+			if (listen_socket < 0) {
+				std::cerr << "couldn't listen on " << address << "\n";
+				return false;
+			}
+		}
+
+		const glm::ivec2 resolution = integrator.ScaledResolution();
+		const uint32_t chunk = job_samples == 0 ? samples : std::min(job_samples, samples);
+
+		jobs.clear();
+		queue.clear();
+		for (int y = 0; y < resolution.y; y += tile_size) {
+			for (int x = 0; x < resolution.x; x += tile_size) {
+				for (uint32_t sample = 0; sample < samples; sample += chunk) {
+					queue.push_back((uint32_t)jobs.size());
+					jobs.push_back({ glm::ivec2(x, y), glm::min(glm::ivec2(x + tile_size, y + tile_size), resolution), sample, std::min(chunk, samples - sample) });
+				}
+			}
+		}
+		finished.assign(jobs.size(), false);
+		size_t remaining = jobs.size();
+
+		integrator.ResetFrameIndex();
+		integrator.Clear();
+
+		const std::vector<char> scene_message = SerializeScene(scene, camera, integrator);
+
+		if (!quiet) {
+			std::cout << "waiting for workers on " << address << "\n";
+		}
+
+		while (remaining > 0) {
+			std::vector<pollfd> fds;
+			fds.push_back({ listen_socket, POLLIN, 0 });
+			for (auto& worker : workers) {
+				fds.push_back({ worker.socket, POLLIN, 0 });
+			}
+
+			if (poll(fds.data(), fds.size(), 500) < 0) {
+				continue;
+			}
+
+			//indices of fds match workers shifted by one, so go backwards as workers get dropped
+			for (int i = (int)workers.size() - 1; i >= 0; i--) {
+				if (!(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+				if (!ReceiveResults(workers[i], integrator, remaining)) {
+					if (!quiet) std::cout << "\nworker disconnected, reissuing " << workers[i].jobs.size() << " jobs\n";
+					DropWorker(i);
+				}
+			}
+
+			if (fds[0].revents & POLLIN) {
+				AcceptWorker(scene_message);
+			}
+
+			auto now = std::chrono::steady_clock::now();
+			for (int i = (int)workers.size() - 1; i >= 0; i--) {
+				if (workers[i].jobs.empty()) continue;
+				if (std::chrono::duration<float>(now - workers[i].last_activity).count() > worker_timeout) {
+					if (!quiet) std::cout << "\nworker timed out, reissuing " << workers[i].jobs.size() << " jobs\n";
+					DropWorker(i);
+				}
+			}
+
+			HandOutJobs();
+
+			if (!quiet) {
+				std::cout << "\rjobs " << jobs.size() - remaining << "/" << jobs.size() << ", workers " << workers.size() << std::flush;
+			}
+		}
+		if (!quiet) {
+			std::cout << "\n";
+		}
+
+		std::vector<char> done = CreateMessage(MessageHeader::Type::Done);
+		for (auto& worker : workers) {
+			SendAll(worker.socket, done.data(), done.size());
+			close(worker.socket);
+		}
+		workers.clear();
+
+		integrator.SetFrameIndex(samples);
+		return true;
+	}
+
+	void RenderCoordinator::AcceptWorker(const std::vector<char>& scene_message)
+	{
+		int fd = accept(listen_socket, nullptr, nullptr);
+		if (fd < 0) return;
+
+		int yes = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+		if (!SendAll(fd, scene_message.data(), scene_message.size())) {
+			close(fd);
+			return;
+		}
+
+		Worker& worker = workers.emplace_back();
+		worker.socket = fd;
+		worker.last_activity = std::chrono::steady_clock::now();
+	}
+
+	void RenderCoordinator::DropWorker(int index)
+	{
+		Worker& worker = workers[index];
+		for (auto it = worker.jobs.rbegin(); it != worker.jobs.rend(); it++) {
+			if (!finished[*it]) {
+				queue.push_front(*it);
+			}
+		}
+		close(worker.socket);
+		workers.erase(workers.begin() + index);
+	}
+
+	void RenderCoordinator::HandOutJobs()
+	{
+		for (int i = (int)workers.size() - 1; i >= 0; i--) {
+			Worker& worker = workers[i];
+			while (worker.jobs.size() < jobs_per_worker && !queue.empty()) {
+				uint32_t id = queue.front();
+				queue.pop_front();
+				if (finished[id]) continue;
+
+				const Job& job = jobs[id];
+				JobHeader header{ id, job.min.x, job.min.y, job.max.x, job.max.y, job.first_sample, job.sample_count };
+				std::vector<char> payload;
+				Append(payload, &header, 1);
+				std::vector<char> message = CreateMessage(MessageHeader::Type::Job, { &payload });
+
+				if (worker.jobs.empty()) {
+					worker.last_activity = std::chrono::steady_clock::now();
+				}
+				worker.jobs.push_back(id);
+				if (!SendAll(worker.socket, message.data(), message.size())) {
+					DropWorker(i);
+					break;
+				}
+			}
+		}
+	}
+
+	bool RenderCoordinator::ReceiveResults(Worker& worker, Integrator& integrator, size_t& remaining)
+	{
+		char buffer[1 << 16];
+		ssize_t received = recv(worker.socket, buffer, sizeof(buffer), 0);
+		if (received <= 0) return false;
+		worker.received.insert(worker.received.end(), buffer, buffer + received);
+
+		size_t offset = 0;
+		while (worker.received.size() - offset >= sizeof(MessageHeader)) {
+			MessageHeader header;
+			std::memcpy(&header, worker.received.data() + offset, sizeof(header));
+			if (worker.received.size() - offset - sizeof(header) < header.size) break;
+
+			const char* payload = worker.received.data() + offset + sizeof(header);
+			offset += sizeof(header) + header.size;
+
+			if (header.type != MessageHeader::Type::Result || header.size < sizeof(JobHeader)) return false;
+
+			JobHeader job;
+			std::memcpy(&job, payload, sizeof(job));
+			payload += sizeof(job);
+
+			Integrator::Tile tile;
+			tile.min = glm::ivec2(job.min_x, job.min_y);
+			tile.max = glm::ivec2(job.max_x, job.max_y);
+			size_t pixels = (size_t)(tile.max.x - tile.min.x) * (tile.max.y - tile.min.y);
+			if (job.id >= jobs.size() || header.size != sizeof(JobHeader) + pixels * sizeof(glm::vec4) * 3) return false;
+
+			worker.jobs.erase(std::remove(worker.jobs.begin(), worker.jobs.end(), job.id), worker.jobs.end());
+			worker.last_activity = std::chrono::steady_clock::now();
+
+			//a reissued job can come back twice
+			if (finished[job.id]) continue;
+
+			for (auto target : { &tile.color, &tile.albedo, &tile.normal }) {
+				target->resize(pixels);
+				std::memcpy(target->data(), payload, pixels * sizeof(glm::vec4));
+				payload += pixels * sizeof(glm::vec4);
+			}
+			integrator.MergeTile(tile);
+			finished[job.id] = true;
+			remaining--;
+		}
+		worker.received.erase(worker.received.begin(), worker.received.begin() + offset);
+		return true;
+	}
+
+	bool RenderWorker::Run()
+	{
+		int fd = -1;
+		auto start = std::chrono::steady_clock::now();
+		while ((fd = OpenSocket(address, false)) < 0) {
+			if (std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count() > connect_timeout) {
+				std::cerr << "couldn't connect to " << address << "\n";
+				return false;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+
+		Scene scene;
+		std::unique_ptr<Camera> camera;
+		std::unique_ptr<Integrator> integrator;
+		uint32_t rendered = 0;
+
+		while (true) {
+			MessageHeader header;
+			std::vector<char> payload;
+			if (!ReceiveAll(fd, &header, sizeof(header))) break;
+			payload.resize(header.size);
+			if (!ReceiveAll(fd, payload.data(), payload.size())) break;
+
+			if (header.type == MessageHeader::Type::Scene) {
+				uint32_t json_size;
+				std::memcpy(&json_size, payload.data(), sizeof(json_size));
+				std::string json(payload.data() + sizeof(json_size), json_size);
+
+				Json::CharReaderBuilder reader;
+				Json::Value root;
+				std::string errors;
+				std::istringstream stream(json);
+				if (!Json::parseFromStream(reader, stream, &root, &errors)) {
+					std::cerr << "couldn't parse the scene: " << errors << "\n";
+					break;
+				}
+
+				std::filesystem::path folder = TemporaryFolder();
+				size_t offset = sizeof(json_size) + json_size;
+				if (!ExtractFolder(payload.data() + offset, payload.size() - offset, folder)) {
+					std::cerr << "the scene is missing files\n";
+					std::filesystem::remove_all(folder);
+					break;
+				}
+				scene.Load(folder.string(), root["scene"]);
+				std::shared_ptr<Texture> world_texture;
+				if (root.isMember("world texture")) {
+					world_texture = Texture::ParseTexture(root["world texture"]);
+				}
+				std::filesystem::remove_all(folder);
+
+				const Json::Value& camera_node = root["camera"];
+				camera.reset(new Camera(camera_node["fov"].asFloat(), 0.01, 100, camera_node["focal distance"].asFloat(), camera_node["lens radius"].asFloat()));
+				camera->SetPosition(ParseVec3(camera_node["position"]));
+				camera->SetDirection(ParseVec3(camera_node["direction"]));
+
+				glm::ivec2 resolution(root["resolution"][0].asInt(), root["resolution"][1].asInt());
+				integrator.reset(new Integrator(root["bounces"].asInt(), resolution, glm::vec2(1)));
+				if (world_texture) {
+					integrator->SetWorldTexture(world_texture);
+				}
+
+				camera->OnResize(resolution);
+				camera->Update(0);
+				scene.Preprocess();
+			}
+			else if (header.type == MessageHeader::Type::Job && integrator && payload.size() == sizeof(JobHeader)) {
+				JobHeader job;
+				std::memcpy(&job, payload.data(), sizeof(job));
+
+				Integrator::Tile tile;
+				tile.min = glm::ivec2(job.min_x, job.min_y);
+				tile.max = glm::ivec2(job.max_x, job.max_y);
+				tile.first_sample = job.first_sample;
+				tile.sample_count = job.sample_count;
+				integrator->RenderTile(scene, *camera, tile);
+
+				std::vector<char> result;
+				Append(result, &job, 1);
+				Append(result, tile.color.data(), tile.color.size());
+				Append(result, tile.albedo.data(), tile.albedo.size());
+				Append(result, tile.normal.data(), tile.normal.size());
+				std::vector<char> message = CreateMessage(MessageHeader::Type::Result, { &result });
+				if (!SendAll(fd, message.data(), message.size())) break;
+
+				rendered++;
+				if (!quiet) {
+					std::cout << "\rrendered " << rendered << " jobs" << std::flush;
+				}
+			}
+			else if (header.type == MessageHeader::Type::Done) {
+				if (!quiet) std::cout << "\n";
+				close(fd);
+				return true;
+			}
+		}
+
+		if (!quiet) std::cout << "\n";
+		std::cerr << "lost the connection to the coordinator\n";
+		close(fd);
+		return false;
+	}
+
+}
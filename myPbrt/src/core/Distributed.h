@@ -0,0 +1,86 @@
+#pragma once
+
+#include "core.h"
+#include "Camera.h"
+#include "Integrator.h"
+
+#include <deque>
+#include <chrono>
+
+namespace MyPBRT {
+
+	//addresses are either "unix:/path/to/socket" or "host:port", an empty host listens on every interface
+	//both ends are expected to run on the same architecture, buffers are sent as they are in memory
+
+	//hands tiles of a frame out to workers and merges what they send back into the integrator
+	class RenderCoordinator
+	{
+	public:
+		uint32_t samples = 64;
+		int tile_size = 64;
+		//samples of a tile handed out in a single job, 0 for all of them
+		uint32_t job_samples = 0;
+		//jobs a worker gets ahead of time so it never waits for the next one
+		int jobs_per_worker = 2;
+		//seconds a worker may go without returning a job before its jobs are given to someone else
+		float worker_timeout = 30.0f;
+		bool quiet = false;
+
+	public:
+		RenderCoordinator(const std::string& _address) : address(_address) {}
+		~RenderCoordinator();
+
+		//blocks until every job has been rendered by some worker, the integrator then holds the whole frame
+		bool Render(const Scene& scene, const Camera& camera, Integrator& integrator);
+
+	private:
+		struct Job {
+			glm::ivec2 min;
+			glm::ivec2 max;
+			uint32_t first_sample;
+			uint32_t sample_count;
+		};
+
+		struct Worker {
+			int socket = -1;
+			std::vector<char> received;
+			std::vector<uint32_t> jobs;
+			std::chrono::steady_clock::time_point last_activity;
+		};
+
+		std::string address;
+		int listen_socket = -1;
+
+		std::vector<Job> jobs;
+		std::vector<bool> finished;
+		std::deque<uint32_t> queue;
+		std::vector<Worker> workers;
+
+	private:
+		std::vector<char> SerializeScene(const Scene& scene, const Camera& camera, Integrator& integrator) const;
+		void AcceptWorker(const std::vector<char>& scene_message);
+		//puts the jobs of the worker back in front of the queue
+		void DropWorker(int index);
+		void HandOutJobs();
+		//merges every finished job that arrived, false if the connection broke
+		bool ReceiveResults(Worker& worker, Integrator& integrator, size_t& remaining);
+	};
+
+	//connects to a coordinator and renders the jobs it gets until it is told to stop
+	class RenderWorker
+	{
+	public:
+		//seconds to keep trying to reach a coordinator that is not listening yet
+		float connect_timeout = 10.0f;
+		bool quiet = false;
+
+	public:
+		RenderWorker(const std::string& _address) : address(_address) {}
+
+		bool Run();
+
+	private:
+		std::string address;
+	};
+
+}
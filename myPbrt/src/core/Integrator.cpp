@@ -6,14 +6,31 @@
 #include "Object.h"
 #include "Mesh.h"
 #include "Light.h"
+#include "Trace.h"
 
 #include <glm/geometric.hpp>
 
 #include <algorithm>
 #include <execution>
+#include <chrono>
+#include <atomic>
+#include <numeric>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define MYPBRT_SSE
+#include <immintrin.h>
+#endif
 
 namespace MyPBRT {
 
+	//entries in the table used to encode [0, 1] floats into bytes
+	constexpr int ENCODE_LUT_SIZE = 4096;
+	constexpr uint32_t MIN_NOISE_SAMPLES = 16;
+	//paths sort_by_material keeps in flight, a few megabytes of state
+	constexpr uint32_t WAVEFRONT_PATHS = 1 << 16;
+	//paths a thread takes at a time
+	constexpr uint32_t WAVEFRONT_CHUNK = 256;
+
 	Integrator::Integrator(uint32_t _bounces, const glm::ivec2& _resolution, const glm::vec2& scale)
 		: image_resolution(_resolution), bounces(_bounces), image_scale(scale)
 	{
@@ -21,6 +38,7 @@ namespace MyPBRT {
 	}
 	void Integrator::Render(const Scene& scene, const Camera& camera)
 	{
+		MYPBRT_TRACE_SCOPE("Integrator::Render");
 		active_camera = &camera;
 		active_scene = &scene;
 
@@ -43,123 +61,636 @@ namespace MyPBRT {
 		for (int i = 0; i < render_resolution.x * render_resolution.y; i++) {
 			image[i] = glm::vec4(0, 0, 0, std::numeric_limits<float>::max());
 		}
+		std::fill(albedo_buffer.begin(), albedo_buffer.end(), glm::vec4(0.0f));
+		std::fill(normal_buffer.begin(), normal_buffer.end(), glm::vec4(0.0f));
+		std::fill(luminance_moments.begin(), luminance_moments.end(), glm::vec2(0.0f));
+		moment_samples = 0;
+		noise_estimate = -1.0f;
+	}
+
+	void Integrator::CameraMoved()
+	{
+		camera_moved = true;
+		DiscardOrKeepHistory();
+	}
+
+	void Integrator::DiscardOrKeepHistory()
+	{
+		if (!temporal_reprojection || rendering_type != RenderingType::PBR || frame == 0) {
+			ResetFrameIndex();
+			Clear();
+			return;
+		}
+
+		std::copy(image, image + render_resolution.x * render_resolution.y, history_buffer.begin());
+		history_frames = frame;
+		frame = 0;
+		reproject_pending = true;
+	}
+
+	glm::ivec2 Integrator::SampleResolution() const
+	{
+		return glm::max(glm::ivec2(glm::ceil(glm::vec2(render_resolution) * dynamic_scale)), glm::ivec2(1));
+	}
+
+	void Integrator::UpdateDynamicScale()
+	{
+		glm::ivec2 previous_samples = SampleResolution();
+
+		if (!dynamic_resolution) {
+			dynamic_scale = 1.0f;
+		}
+		else if (camera_moved) {
+			//cost is roughly proportional to the pixel count
+			if (last_render_time > 0.0f) {
+				float budget_scale = dynamic_scale * std::sqrt(target_frame_time / last_render_time);
+				dynamic_scale = glm::mix(dynamic_scale, budget_scale, 0.5f);
+			}
+		}
+		else {
+			//standing still, refine towards the full resolution
+			dynamic_scale *= 1.5f;
+		}
+		dynamic_scale = glm::clamp(dynamic_scale, glm::clamp(min_dynamic_scale, 0.01f, 1.0f), 1.0f);
+		camera_moved = false;
+
+		//samples from a different lattice can't be averaged together
+		if (SampleResolution() != previous_samples && frame > 0) {
+			DiscardOrKeepHistory();
+		}
 	}
 
 	void Integrator::RenderRayTraced()
 	{
+		MYPBRT_TRACE_SCOPE("Integrator::RenderRayTraced");
+		//keep showing the final image until something resets the accumulation
+		if (Finished() && frame > 0) {
+			return;
+		}
+
+		UpdateDynamicScale();
+
 		frame++;
 
+		auto start = std::chrono::steady_clock::now();
+
 		if (frame == 1) {
 			Clear();
+			stop_reason = StopReason::None;
+			accumulation_start = start;
+			ray_count = 0;
 		}
 
-		//multithreaded
+		std::atomic<uint64_t> frame_rays = 0;
+#ifdef MYPBRT_STATS
+		CounterValues counters_before = Stats::Collect();
+#endif
+
+		//every sample covers a block of pixels when rendering below the full resolution
+		const glm::ivec2 samples = SampleResolution();
+		const glm::vec2 block_size = glm::vec2(render_resolution) / glm::vec2(samples);
+
+		auto trace_sample = [this, samples, block_size, &frame_rays](uint32_t x, uint32_t y) {
+			PrimaryHit primary;
+			glm::vec3 light = TraceCameraSample({ x, y }, samples.x, frame, block_size, &primary);
+			frame_rays.fetch_add(primary.rays, std::memory_order_relaxed);
+			AccumulateSample({ x, y }, block_size, light, primary);
+		};
+
+		if (sort_by_material) {
+			frame_rays = RenderSortedByMaterial(samples, block_size);
+		}
+		else {
+			//multithreaded
 #if 1
-		std::for_each(std::execution::par, height_iterator.begin(), height_iterator.end(), [this](uint32_t y) {
-			std::for_each(std::execution::par, width_iterator.begin(), width_iterator.end(), [this, y](uint32_t x) {
+			std::for_each(std::execution::par, height_iterator.begin(), height_iterator.begin() + samples.y, [this, samples, &trace_sample](uint32_t y) {
+				std::for_each(std::execution::par, width_iterator.begin(), width_iterator.begin() + samples.x, [y, &trace_sample](uint32_t x) {
+					trace_sample(x, y);
+					});
+			});
 
-				Ray ray = active_camera->GetRay(glm::ivec2(x, y));
-				glm::vec3 light = TraceRay(&ray);
-				image[x + y * render_resolution.x] += glm::vec4(light, 0);
+#else
+			std::for_each(height_iterator.begin(), height_iterator.begin() + samples.y, [this, samples, &trace_sample](uint32_t y) {
+				std::for_each(width_iterator.begin(), width_iterator.begin() + samples.x, [y, &trace_sample](uint32_t x) {
+					trace_sample(x, y);
+					});
+				});
 
+#endif
+		}
+
+		last_render_time = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		if (reproject_pending) {
+			Reproject();
+			reproject_pending = false;
+		}
+
+		rendered_view_projection = active_camera->GetProjection() * active_camera->GetView();
+		rendered_camera_position = active_camera->GetPosition();
+
+		last_frame_rays = frame_rays;
+		ray_count += last_frame_rays;
+#ifdef MYPBRT_STATS
+		CounterValues counters_after = Stats::Collect();
+		for (int i = 0; i < COUNTER_COUNT; i++) {
+			frame_counters[i] = counters_after[i] - counters_before[i];
+		}
+#endif
+		moment_samples++;
+		CheckBudgets();
+	}
+
+	void Integrator::EstimateNoise()
+	{
+		MYPBRT_TRACE_SCOPE("Integrator::EstimateNoise");
+		//the variance of a handful of samples is too noisy itself to stop on
+		if (moment_samples < MIN_NOISE_SAMPLES) {
+			noise_estimate = -1.0f;
+			return;
+		}
+
+		//standard error of the mean over the mean, dark pixels are compared against a floor so they don't dominate
+		const float n = (float)moment_samples;
+		std::vector<float> row_error(render_resolution.y);
+		std::for_each(std::execution::par, height_iterator.begin(), height_iterator.end(), [&](uint32_t y) {
+			float sum = 0;
+			for (int x = 0; x < render_resolution.x; x++) {
+				glm::vec2 moments = luminance_moments[x + y * render_resolution.x] / n;
+				float variance = std::max(moments.y - moments.x * moments.x, 0.0f) * n / (n - 1);
+				sum += std::sqrt(variance / n) / std::max(moments.x, 0.01f);
+			}
+			row_error[y] = sum;
+			});
+
+		float sum = 0;
+		for (float error : row_error) sum += error;
+		noise_estimate = sum / (float)(render_resolution.x * render_resolution.y);
+	}
+
+	void Integrator::CheckBudgets()
+	{
+		if (noise_threshold > 0.0f) {
+			EstimateNoise();
+		}
+
+		float time = GetRenderTime();
+		if (target_samples > 0 && frame >= (uint32_t)target_samples) {
+			stop_reason = StopReason::Samples;
+		}
+		else if (time_budget > 0.0f && time >= time_budget) {
+			stop_reason = StopReason::Time;
+		}
+		else if (noise_threshold > 0.0f && noise_estimate >= 0.0f && noise_estimate <= noise_threshold) {
+			stop_reason = StopReason::Noise;
+		}
+
+		if (Finished()) {
+			finished_time = time;
+		}
+	}
+
+	float Integrator::GetRenderTime() const
+	{
+		if (Finished()) {
+			return finished_time;
+		}
+		if (frame == 0) {
+			return 0.0f;
+		}
+		return std::chrono::duration<float>(std::chrono::steady_clock::now() - accumulation_start).count();
+	}
+
+	void Integrator::SetWorldTexture(std::shared_ptr<Texture> texture)
+	{
+		world_texture = texture;
+		environment = texture ? EnvironmentLight::Create(texture) : nullptr;
+	}
+
+	std::string Integrator::GetReport() const
+	{
+		float time = GetRenderTime();
+		char report[256];
+		snprintf(report, sizeof(report), "%u spp in %.2f s, %.2f Mrays/s", frame, time, time > 0 ? ray_count / time * 1e-6f : 0.0f);
+
+		std::string result = report;
+		if (noise_estimate >= 0.0f) {
+			snprintf(report, sizeof(report), ", noise %.4f", noise_estimate);
+			result += report;
+		}
+		if (Finished()) {
+			result += std::string(", stopped by the ") + stop_reason_options[(int)stop_reason];
+		}
+		return result;
+	}
+
+	void Integrator::AccumulateSample(const glm::uvec2& cell, const glm::vec2& block_size, const glm::vec3& light, const PrimaryHit& primary)
+	{
+		float luminance = glm::dot(light, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+
+		glm::ivec2 block_min = glm::ivec2(glm::vec2(cell) * block_size);
+		glm::ivec2 block_max = glm::min(glm::ivec2(glm::vec2(cell + 1u) * block_size), render_resolution);
+		for (int py = block_min.y; py < block_max.y; py++) {
+			for (int px = block_min.x; px < block_max.x; px++) {
+				uint32_t pixel = px + py * render_resolution.x;
+				image[pixel] += glm::vec4(light, 0);
+				image[pixel].w = primary.depth;
+				albedo_buffer[pixel] += glm::vec4(primary.albedo, 0);
+				normal_buffer[pixel] += glm::vec4(primary.normal, 0);
+				luminance_moments[pixel] += glm::vec2(luminance, luminance * luminance);
+			}
+		}
+	}
+
+	//runs fn(begin, end) over [0, count) in parallel chunks
+	template <typename F>
+	static void ParallelChunks(uint32_t count, F&& fn)
+	{
+		std::vector<uint32_t> chunks((count + WAVEFRONT_CHUNK - 1) / WAVEFRONT_CHUNK);
+		std::iota(chunks.begin(), chunks.end(), 0);
+		std::for_each(std::execution::par, chunks.begin(), chunks.end(), [&](uint32_t chunk) {
+			fn(chunk * WAVEFRONT_CHUNK, std::min((chunk + 1) * WAVEFRONT_CHUNK, count));
+			});
+	}
+
+	uint64_t Integrator::RenderSortedByMaterial(const glm::ivec2& samples, const glm::vec2& block_size)
+	{
+		MYPBRT_TRACE_SCOPE("Integrator::RenderSortedByMaterial");
+		const std::vector<MaterialRecord>& table = active_scene->material_table;
+		//hits are keyed by their material, paths that ended by the key after the last one
+		const uint32_t done_key = std::max<uint32_t>(table.size(), 1);
+		const uint32_t rows = std::max<uint32_t>(WAVEFRONT_PATHS / samples.x, 1);
+		uint64_t rays = 0;
+
+		for (uint32_t first_row = 0; first_row < samples.y; first_row += rows) {
+			const uint32_t count = std::min<uint32_t>(rows, samples.y - first_row) * samples.x;
+			wave_paths.resize(count);
+			wave_active.resize(count);
+			ParallelChunks(count, [&](uint32_t begin, uint32_t end) {
+				for (uint32_t i = begin; i < end; i++) {
+					wave_paths[i] = PathState();
+					StartCameraPath(wave_paths[i], glm::uvec2(i % samples.x, first_row + i / samples.x), samples.x, frame, block_size);
+					wave_paths[i].random = random_stream();
+					wave_active[i] = i;
+				}
 				});
-		});
 
-#else
-		std::for_each(height_iterator.begin(), height_iterator.end(), [this](uint32_t y) {
-			std::for_each(width_iterator.begin(), width_iterator.end(), [this, y](uint32_t x) {
+			uint32_t active = count;
+			while (active > 0) {
+				wave_keys.resize(active);
+				ParallelChunks(active, [&](uint32_t begin, uint32_t end) {
+					for (uint32_t i = begin; i < end; i++) {
+						PathState& path = wave_paths[wave_active[i]];
+						if (!IntersectPath(path)) {
+							ShadeMiss(path);
+							wave_keys[i] = done_key;
+						}
+						else {
+							wave_keys[i] = table.empty() ? 0 : active_scene->objects[path.interaction.primitive].material;
+						}
+					}
+					});
 
-				Ray ray = active_camera->GetRay(glm::ivec2(x, y));
-				glm::vec3 light = TraceRay(&ray);
-				image[x + y * render_resolution.x] += glm::vec4(light, 0);
+				//counting sort, so every material shades one contiguous run of paths
+				wave_offsets.assign(done_key + 1, 0);
+				for (uint32_t i = 0; i < active; i++) {
+					wave_offsets[wave_keys[i]]++;
+				}
+				const uint32_t hits = active - wave_offsets[done_key];
+				std::exclusive_scan(wave_offsets.begin(), wave_offsets.end(), wave_offsets.begin(), 0u);
+				wave_sorted.resize(active);
+				for (uint32_t i = 0; i < active; i++) {
+					wave_sorted[wave_offsets[wave_keys[i]]++] = wave_active[i];
+				}
 
+				wave_alive.resize(hits);
+				ParallelChunks(hits, [&](uint32_t begin, uint32_t end) {
+					for (uint32_t i = begin; i < end; i++) {
+						PathState& path = wave_paths[wave_sorted[i]];
+						random_stream() = path.random;
+						wave_alive[i] = ShadeHit(path, HitMaterial(path.interaction)) && path.depth < bounces;
+						path.random = random_stream();
+					}
+					});
+
+				active = 0;
+				for (uint32_t i = 0; i < hits; i++) {
+					if (wave_alive[i]) {
+						wave_active[active++] = wave_sorted[i];
+					}
+				}
+			}
+
+			ParallelChunks(count, [&](uint32_t begin, uint32_t end) {
+				for (uint32_t i = begin; i < end; i++) {
+					AccumulateSample(glm::uvec2(i % samples.x, first_row + i / samples.x), block_size, wave_paths[i].Radiance(), wave_paths[i].primary);
+				}
 				});
-			});
+			for (uint32_t i = 0; i < count; i++) {
+				rays += wave_paths[i].primary.rays;
+			}
+		}
+		return rays;
+	}
 
-#endif
+	glm::vec3 Integrator::TraceCameraSample(const glm::uvec2& cell, uint32_t cells_per_row, uint32_t sample, const glm::vec2& block_size, PrimaryHit* primary) const
+	{
+		PathState path;
+		StartCameraPath(path, cell, cells_per_row, sample, block_size);
+		TracePath(path);
+		*primary = path.primary;
+		return path.Radiance();
 	}
 
-	glm::vec3 Integrator::TraceRay(Ray* ray, int depth) const
+	void Integrator::StartCameraPath(PathState& path, const glm::uvec2& cell, uint32_t cells_per_row, uint32_t sample, const glm::vec2& block_size) const
 	{
-		SurfaceInteraction interaction;
-		interaction.wo = glm::vec3(-1.0f);
-		glm::vec3 color(0.0f);
-		glm::vec3 contribution(1.0f);
+		MYPBRT_COUNT(CameraRays);
+		seed_random(cell.x + cell.y * cells_per_row, sample);
+		glm::vec2 raster = (glm::vec2(cell) + glm::vec2(random_double(), random_double())) * block_size;
+		path.ray = active_camera->GetRay(glm::ivec2(raster), glm::fract(raster));
+	}
 
-		float prev_pdf = 1;
+	void Integrator::RenderTile(const Scene& scene, const Camera& camera, Tile& tile)
+	{
+		MYPBRT_TRACE_SCOPE("Integrator::RenderTile");
+		active_camera = &camera;
+		active_scene = &scene;
 
-		while (depth < bounces) {
-			depth++;
+		const glm::ivec2 size = tile.max - tile.min;
+		tile.color.assign(size.x * size.y, glm::vec4(0, 0, 0, INFINITY));
+		tile.albedo.assign(size.x * size.y, glm::vec4(0));
+		tile.normal.assign(size.x * size.y, glm::vec4(0));
+
+		std::for_each(std::execution::par, height_iterator.begin() + tile.min.y, height_iterator.begin() + tile.max.y, [&](uint32_t y) {
+			for (int x = tile.min.x; x < tile.max.x; x++) {
+				uint32_t pixel = (x - tile.min.x) + (y - tile.min.y) * size.x;
+				for (uint32_t sample = tile.first_sample; sample < tile.first_sample + tile.sample_count; sample++) {
+					//frames are counted from 1
+					PrimaryHit primary;
+					glm::vec3 light = TraceCameraSample(glm::uvec2(x, y), render_resolution.x, sample + 1, glm::vec2(1.0f), &primary);
+					tile.color[pixel] += glm::vec4(light, 0);
+					tile.color[pixel].w = primary.depth;
+					tile.albedo[pixel] += glm::vec4(primary.albedo, 0);
+					tile.normal[pixel] += glm::vec4(primary.normal, 0);
+				}
+			}
+		});
+	}
 
-			if (!active_scene->IntersectAccel(*ray, &interaction)) {
+	void Integrator::MergeTile(const Tile& tile)
+	{
+		const glm::ivec2 size = tile.max - tile.min;
+		for (int y = 0; y < size.y; y++) {
+			for (int x = 0; x < size.x; x++) {
+				uint32_t source = x + y * size.x;
+				uint32_t pixel = (tile.min.x + x) + (tile.min.y + y) * render_resolution.x;
+				image[pixel] += glm::vec4(glm::vec3(tile.color[source]), 0);
+				image[pixel].w = tile.color[source].w;
+				albedo_buffer[pixel] += tile.albedo[source];
+				normal_buffer[pixel] += tile.normal[source];
+			}
+		}
+	}
 
-				if (world_texture) {
-					glm::vec3 spherePos = glm::normalize(ray->d);
-					float theta = acos(-spherePos.y);
-					float phi = atan2(-spherePos.z, spherePos.x) + PIf;
-					interaction.uv = glm::vec2(phi / (2.0f * PIf), theta / PIf);
-					glm::vec4 col = world_texture->Evaluate(interaction);
-					color += glm::vec3(col.x, col.y, col.z);
+	void Integrator::Reproject()
+	{
+		MYPBRT_TRACE_SCOPE("Integrator::Reproject");
+		//the image holds a single new sample, every pixel looks up where its surface was in the previous view
+		//and takes over that history if the depth there agrees, otherwise the surface was disoccluded
+		const uint32_t new_frame = std::min(history_frames, (uint32_t)glm::max(max_history_frames, 0)) + 1;
+		const float history_scale = (float)(new_frame - 1) / (float)history_frames;
+		const glm::vec2 resolution = glm::vec2(render_resolution);
+
+		std::for_each(std::execution::par, height_iterator.begin(), height_iterator.end(), [&](uint32_t y) {
+			for (int x = 0; x < render_resolution.x; x++) {
+				int pixel = x + y * render_resolution.x;
+				glm::vec4& current = image[pixel];
+				glm::vec3 dir = active_camera->GetRayDirection(glm::ivec2(x, y));
+
+				bool sky = current.w >= INFINITY;
+				glm::vec3 world = active_camera->GetPosition() + dir * current.w;
+				glm::vec4 clip = sky ? rendered_view_projection * glm::vec4(dir, 0.0f) : rendered_view_projection * glm::vec4(world, 1.0f);
+
+				bool valid = clip.w > 0.0f;
+				glm::ivec2 previous(-1);
+				if (valid) {
+					glm::vec2 ndc = glm::vec2(clip) / clip.w;
+					previous = glm::ivec2(glm::floor((ndc * 0.5f + 0.5f) * resolution));
+					valid = previous.x >= 0 && previous.y >= 0 && previous.x < render_resolution.x && previous.y < render_resolution.y;
+				}
+
+				if (valid) {
+					float history_depth = history_buffer[previous.x + previous.y * render_resolution.x].w;
+					if (sky) {
+						valid = history_depth >= INFINITY;
+					}
+					else {
+						float expected_depth = glm::distance(world, rendered_camera_position);
+						valid = history_depth < INFINITY && std::abs(history_depth - expected_depth) < 0.05f * expected_depth;
+					}
+				}
+
+				//the aovs have no history, a single sample is weighted as the whole pixel
+				albedo_buffer[pixel] *= (float)new_frame;
+				normal_buffer[pixel] *= (float)new_frame;
+
+				if (valid) {
+					glm::vec3 history = glm::vec3(history_buffer[previous.x + previous.y * render_resolution.x]);
+					current = glm::vec4(glm::vec3(current) + history * history_scale, current.w);
 				}
 				else {
-					float t = 0.5f * (ray->d.y + 1.0f);
-					glm::vec3 skylight = glm::vec3(1.0f - t) * glm::vec3(1.0, 1.0, .8) + glm::vec3(t) * glm::vec3(0.5, 0.7, 1.0);
-					color += skylight * 1.075f;
+					current = glm::vec4(glm::vec3(current) * (float)new_frame, current.w);
 				}
+			}
+			});
+
+		frame = new_frame;
+	}
 
+	//weight of a sample of the strategy with pdf a when strategy b could have taken it too
+	static float PowerHeuristic(float a, float b)
+	{
+		if (std::isinf(a)) return 1.0f;
+		return a * a / (a * a + b * b);
+	}
+
+	glm::vec3 Integrator::TraceRay(Ray* ray, int depth, PrimaryHit* primary) const
+	{
+		PathState path;
+		path.ray = *ray;
+		path.depth = depth;
+		TracePath(path);
+		*ray = path.ray;
+		if (primary) *primary = path.primary;
+		return path.Radiance();
+	}
+
+	void Integrator::TracePath(PathState& path) const
+	{
+		while (path.depth < bounces) {
+			if (!IntersectPath(path)) {
+				ShadeMiss(path);
 				break;
 			}
-
-			if (interaction.front_face == false) {
-				interaction.normal = -interaction.normal;
+			if (!ShadeHit(path, HitMaterial(path.interaction))) {
+				break;
 			}
+		}
+	}
 
-			if (active_scene->materials.size() == 0) return glm::vec3(1, 0, 1);
-			const std::shared_ptr<Material>& material = active_scene->materials[active_scene->objects[interaction.primitive].material];
-			
-			color += material->EvaluateLight(interaction);
-			glm::vec3 materialColor = material->Evaluate(&interaction);
+	bool Integrator::IntersectPath(PathState& path) const
+	{
+		path.depth++;
+		path.primary.rays++;
+		return active_scene->IntersectAccel(path.ray, &path.interaction);
+	}
 
-			bool has_pdf = false;
-			if (!material->ScatterRay(interaction, ray->d, has_pdf)) {
-				break;
+	const MaterialRecord* Integrator::HitMaterial(const SurfaceInteraction& interaction) const
+	{
+		if (active_scene->material_table.empty()) return nullptr;
+		return &active_scene->material_table[active_scene->objects[interaction.primitive].material];
+	}
+
+	void Integrator::ShadeMiss(PathState& path) const
+	{
+		const Ray& ray = path.ray;
+		glm::vec3 background;
+		if (world_texture) {
+			path.interaction.uv = EnvironmentLight::DirectionToUV(glm::normalize(ray.d));
+			//v covers pi radians
+			path.interaction.uv_footprint = ray.cone_spread / PIf;
+			glm::vec4 col = world_texture->Evaluate(path.interaction);
+			background = glm::vec3(col.x, col.y, col.z);
+			if (path.lights_sampled && environment) {
+				background *= PowerHeuristic(path.prev_pdf, environment->PDF_Value(ray.d));
 			}
+		}
+		else {
+			float t = 0.5f * (ray.d.y + 1.0f);
+			glm::vec3 skylight = glm::vec3(1.0f - t) * glm::vec3(1.0, 1.0, .8) + glm::vec3(t) * glm::vec3(0.5, 0.7, 1.0);
+			background = skylight * 1.075f;
+		}
+		path.color += background * glm::clamp(path.contribution, 0.0f, 1.0f);
+
+		if (path.depth == 1) {
+			path.primary.albedo = background;
+		}
+	}
 
-			if (has_pdf) {
-				glm::vec3 d = ray->d;
-				if (active_scene->lights.size() > 0)
-				{
-					int index = random_int(0, active_scene->lights.size() - 1);
-					const std::shared_ptr<Light>& light = active_scene->lights[index];
-					glm::vec3 point_on_light = light->Sample(interaction);
-					ray->d = point_on_light - interaction.pos;
-
-					if (glm::dot(interaction.normal, ray->d) < 0) goto material;
-					ray->tMax = glm::distance(point_on_light, interaction.pos);
-					if (active_scene->hasIntersectionsAccel(*ray)) goto material;
-
-					float light_pdf = light->PDF_Value(interaction, ray->d);
-					color += light->Color() / light_pdf;
+	bool Integrator::ShadeHit(PathState& path, const MaterialRecord* material) const
+	{
+		Ray* ray = &path.ray;
+		SurfaceInteraction& interaction = path.interaction;
+		PrimaryHit* primary = &path.primary;
+
+		if (interaction.front_face == false) {
+			interaction.normal = -interaction.normal;
+		}
+
+		//bounces keep the spread of the cone, so rough surfaces get the footprint a mirror would have
+		ray->cone_width += ray->cone_spread * glm::distance(ray->o, interaction.pos);
+		interaction.SetFootprint(ray->cone_width, ray->d);
+
+		if (!material) {
+			path.color = glm::vec3(1, 0, 1);
+			path.light_color = glm::vec3(0.0f);
+			return false;
+		}
+
+		glm::vec3 emitted = material->EvaluateLight(interaction);
+		if (path.lights_sampled && emitted != glm::vec3(0.0f)) {
+			emitted *= PowerHeuristic(path.prev_pdf, active_scene->EmissivePDF(ray->o, interaction));
+		}
+		path.color += emitted * glm::clamp(path.contribution, 0.0f, 1.0f);
+		glm::vec3 materialColor = material->Evaluate(interaction);
+		MYPBRT_COUNT(MaterialEvaluations);
+
+		if (path.depth == 1) {
+			primary->albedo = materialColor;
+			primary->normal = interaction.normal;
+			primary->depth = ray->tMax;
+		}
+
+		bool has_pdf = false;
+		if (!material->ScatterRay(interaction, ray->d, has_pdf)) {
+			return false;
+		}
+
+		if (has_pdf) {
+			glm::vec3 d = ray->d;
+			if (active_scene->lights.size() > 0)
+			{
+				int index = random_int(0, active_scene->lights.size() - 1);
+				const std::shared_ptr<Light>& light = active_scene->lights[index];
+				glm::vec3 point_on_light = light->Sample(interaction);
+				ray->d = point_on_light - interaction.pos;
+
+				if (glm::dot(interaction.normal, ray->d) < 0) goto material;
+				ray->tMax = glm::distance(point_on_light, interaction.pos);
+				primary->rays++;
+				if (active_scene->hasIntersectionsAccel(*ray)) goto material;
+
+				float light_pdf = light->PDF_Value(interaction, ray->d);
+				path.light_color += light->Color() / light_pdf;
+			}
+		material:
+			ray->d = d;
+
+			//only the diffuse lobe picks directions the way Pdf_Value describes them
+			//both estimate what the ray the material picked would see of them, so they get the contribution it would get
+			//and are skipped when that ray is past the last bounce
+			glm::vec3 direct(0.0f);
+			path.lights_sampled = material->has_pdf && path.depth < bounces;
+			if (path.lights_sampled && environment) {
+				float environment_pdf;
+				glm::vec3 direction = environment->Sample(&environment_pdf);
+				float material_pdf = material->Pdf_Value(direction, interaction.normal);
+				if (environment_pdf > 0 && material_pdf > 0) {
+					Ray shadow(interaction.pos + direction * 0.0001f, direction);
+					primary->rays++;
+					if (!active_scene->hasIntersectionsAccel(shadow)) {
+						float weight = PowerHeuristic(environment_pdf, material_pdf) * material_pdf / environment_pdf;
+						direct += environment->Evaluate(direction) * weight;
+					}
 				}
-			material:
-				ray->d = d;
-				contribution *= materialColor / prev_pdf;
-				prev_pdf = material->Pdf_Value(ray->d, interaction.normal);
 			}
-			else {
-				contribution *= materialColor / prev_pdf;
-				prev_pdf = 1;
+
+			SurfaceInteraction light_point;
+			float emissive_pdf;
+			if (path.lights_sampled && active_scene->SampleEmissive(interaction.pos, &light_point, &emissive_pdf)) {
+				glm::vec3 direction = light_point.pos - interaction.pos;
+				float distance = glm::length(direction);
+				direction /= distance;
+				float material_pdf = material->Pdf_Value(direction, interaction.normal);
+				if (material_pdf > 0) {
+					//stops just short of the light so it doesn't shadow itself
+					Ray shadow(interaction.pos + direction * 0.0001f, direction, distance * 0.999f);
+					primary->rays++;
+					if (!active_scene->hasIntersectionsAccel(shadow)) {
+						float weight = PowerHeuristic(emissive_pdf, material_pdf) * material_pdf / emissive_pdf;
+						direct += HitMaterial(light_point)->EvaluateLight(light_point) * weight;
+					}
+				}
 			}
 
-			ray->o = interaction.pos + ray->d * 0.0001f;
-			ray->tMax = std::numeric_limits<float>::max();
+			path.contribution *= materialColor / path.prev_pdf;
+			path.prev_pdf = material->Pdf_Value(ray->d, interaction.normal);
+			path.color += direct * glm::clamp(path.contribution, 0.0f, 1.0f);
+		}
+		else {
+			path.contribution *= materialColor / path.prev_pdf;
+			path.prev_pdf = 1;
+			path.lights_sampled = false;
 		}
 
-		return color * glm::clamp(contribution, 0.0f, 1.0f);
+		ray->o = interaction.pos + ray->d * 0.0001f;
+		ray->tMax = std::numeric_limits<float>::max();
+		return true;
 	}
 
 	void Integrator::RenderWireframe()
 	{
+		MYPBRT_TRACE_SCOPE("Integrator::RenderWireframe");
 		std::for_each(std::execution::par, height_iterator.begin(), height_iterator.end(), [this](uint32_t y) {
 			std::for_each(std::execution::par, width_iterator.begin(), width_iterator.end(), [this, y](uint32_t x) {
 				Ray ray = active_camera->GetRay(glm::ivec2(x, y));
@@ -177,6 +708,7 @@ namespace MyPBRT {
 
 	void Integrator::RenderRasterized()
 	{
+		MYPBRT_TRACE_SCOPE("Integrator::RenderRasterized");
 		frame = 1;
 		Clear();
 
@@ -316,6 +848,14 @@ namespace MyPBRT {
 		delete[] output_image;
 		output_image = new uint32_t[render_resolution.x * render_resolution.y];
 
+		albedo_buffer.resize(render_resolution.x * render_resolution.y);
+		normal_buffer.resize(render_resolution.x * render_resolution.y);
+		luminance_moments.resize(render_resolution.x * render_resolution.y);
+		for (auto& buffer : denoise_buffers) {
+			buffer.resize(render_resolution.x * render_resolution.y);
+		}
+		history_buffer.resize(render_resolution.x * render_resolution.y);
+
 		width_iterator.resize(render_resolution.x);
 		height_iterator.resize(render_resolution.y);
 		for (uint32_t i = 0; i < render_resolution.x; i++) {
@@ -330,26 +870,219 @@ namespace MyPBRT {
 
 	uint32_t* Integrator::GetImage(bool overlays)
 	{
-		float inverse_frame = 1.0f / (float)frame;
-		for (int x = 0; x < render_resolution.x; x++) {
-			for (int y = 0; y < render_resolution.y; y++) {
-				glm::vec4 pixel = image[x + y * render_resolution.x];
-				//color = glm::sqrt(color);
-				if (depth_only) {
-					output_image[x + y * render_resolution.x] = ToUint(glm::vec4(pixel.w, pixel.w, pixel.w, 1.0f));
-					continue;
-				}
-				
-				output_image[x + y * render_resolution.x] = ToUint(glm::vec4(glm::vec3(pixel.r, pixel.g, pixel.b) * inverse_frame, 1.0f));
-			}
+		MYPBRT_TRACE_SCOPE("Integrator::GetImage");
+		const glm::vec4* source = image;
+		float scale = std::exp2(exposure) / (float)frame;
+		if (denoise && rendering_type == RenderingType::PBR && !depth_only) {
+			source = Denoise();
+			scale = std::exp2(exposure);
 		}
+
+		std::for_each(std::execution::par, height_iterator.begin(), height_iterator.end(), [this, source, scale](uint32_t y) {
+			ResolveRow(source, y, scale);
+			});
 		if (overlays)
 			DrawOverlays();
 		return output_image;
 	}
 
+	std::vector<glm::vec3> Integrator::GetRadiance()
+	{
+		const glm::vec4* source = image;
+		float scale = std::exp2(exposure) / (float)frame;
+		if (denoise && rendering_type == RenderingType::PBR) {
+			source = Denoise();
+			scale = std::exp2(exposure);
+		}
+
+		std::vector<glm::vec3> radiance(render_resolution.x * render_resolution.y);
+		for (int i = 0; i < radiance.size(); i++) {
+			radiance[i] = glm::vec3(source[i]) * scale;
+		}
+		return radiance;
+	}
+
+	static std::array<uint8_t, ENCODE_LUT_SIZE> BuildEncodeLUT(bool srgb)
+	{
+		std::array<uint8_t, ENCODE_LUT_SIZE> lut;
+		for (int i = 0; i < ENCODE_LUT_SIZE; i++) {
+			float c = (float)i / (float)(ENCODE_LUT_SIZE - 1);
+			if (srgb)
+				c = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+			lut[i] = (uint8_t)(glm::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+		}
+		return lut;
+	}
+
+#ifndef MYPBRT_SSE
+	static float ToneMap(float c, Integrator::ToneMapping tone_mapping)
+	{
+		switch (tone_mapping) {
+		case Integrator::ToneMapping::Reinhard:
+			return c / (1.0f + c);
+		case Integrator::ToneMapping::ACES:
+			//Narkowicz's fit
+			return (c * (2.51f * c + 0.03f)) / (c * (2.43f * c + 0.59f) + 0.14f);
+		default:
+			return c;
+		}
+	}
+#endif
+
+	const glm::vec4* Integrator::Denoise()
+	{
+		MYPBRT_TRACE_SCOPE("Integrator::Denoise");
+		//edge avoiding a-trous wavelet filter (Dammertz et al. 2010) guided by the albedo, normal and depth aovs,
+		//the lighting is filtered with the albedo divided out so textures stay sharp
+		const float kernel[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+		const float inverse_frame = 1.0f / (float)frame;
+		const int width = render_resolution.x, height = render_resolution.y;
+
+		auto demodulate = [](const glm::vec3& albedo) { return glm::max(albedo, glm::vec3(0.01f)); };
+
+		std::for_each(std::execution::par, height_iterator.begin(), height_iterator.end(), [&](uint32_t y) {
+			for (int x = 0; x < width; x++) {
+				int pixel = x + y * width;
+				glm::vec3 albedo = glm::vec3(albedo_buffer[pixel]) * inverse_frame;
+				glm::vec3 color = glm::vec3(image[pixel]) * inverse_frame;
+				denoise_buffers[0][pixel] = glm::vec4(color / demodulate(albedo), image[pixel].w);
+			}
+			});
+
+		//noise falls off with the square root of the sample count, so should the color edge stopping
+		float color_phi = denoise_strength / std::sqrt((float)frame);
+		int source = 0;
+		for (int iteration = 0; iteration < denoise_iterations; iteration++) {
+			const int step = 1 << iteration;
+			const float inverse_color_phi = 1.0f / glm::max(color_phi * color_phi, 1e-6f);
+			const std::vector<glm::vec4>& in = denoise_buffers[source];
+			std::vector<glm::vec4>& out = denoise_buffers[1 - source];
+
+			std::for_each(std::execution::par, height_iterator.begin(), height_iterator.end(), [&](uint32_t y) {
+				for (int x = 0; x < width; x++) {
+					int pixel = x + y * width;
+					const glm::vec4& center = in[pixel];
+					glm::vec3 center_normal = glm::vec3(normal_buffer[pixel]);
+					bool center_has_normal = glm::length2(center_normal) > 0.0f;
+					if (center_has_normal) center_normal = glm::normalize(center_normal);
+
+					glm::vec3 sum(0.0f);
+					float weight_sum = 0.0f;
+					for (int dy = -2; dy <= 2; dy++) {
+						int sy = (int)y + dy * step;
+						if (sy < 0 || sy >= height) continue;
+						for (int dx = -2; dx <= 2; dx++) {
+							int sx = x + dx * step;
+							if (sx < 0 || sx >= width) continue;
+
+							int sample = sx + sy * width;
+							const glm::vec4& value = in[sample];
+
+							glm::vec3 normal = glm::vec3(normal_buffer[sample]);
+							bool has_normal = glm::length2(normal) > 0.0f;
+							if (has_normal != center_has_normal) continue;
+							float normal_weight = 1.0f;
+							if (has_normal) {
+								normal_weight = glm::pow(glm::max(glm::dot(center_normal, glm::normalize(normal)), 0.0f), 32.0f);
+							}
+
+							float depth_weight = 1.0f;
+							if (center.w < INFINITY && value.w < INFINITY) {
+								depth_weight = std::exp(-std::abs(center.w - value.w) / (0.05f * center.w * step + 1e-4f));
+							}
+
+							glm::vec3 difference = glm::vec3(value) - glm::vec3(center);
+							float color_weight = std::exp(-glm::min(glm::dot(difference, difference) * inverse_color_phi, 80.0f));
+
+							float weight = kernel[std::abs(dx)] * kernel[std::abs(dy)] * normal_weight * depth_weight * color_weight;
+							sum += glm::vec3(value) * weight;
+							weight_sum += weight;
+						}
+					}
+
+					out[pixel] = glm::vec4(weight_sum > 0.0f ? sum / weight_sum : glm::vec3(center), center.w);
+				}
+				});
+
+			color_phi *= 0.5f;
+			source = 1 - source;
+		}
+
+		std::vector<glm::vec4>& result = denoise_buffers[source];
+		std::for_each(std::execution::par, height_iterator.begin(), height_iterator.end(), [&](uint32_t y) {
+			for (int x = 0; x < width; x++) {
+				int pixel = x + y * width;
+				glm::vec3 albedo = glm::vec3(albedo_buffer[pixel]) * inverse_frame;
+				result[pixel] = glm::vec4(glm::vec3(result[pixel]) * demodulate(albedo), result[pixel].w);
+			}
+			});
+
+		return result.data();
+	}
+
+	void Integrator::ResolveRow(const glm::vec4* source, uint32_t y, float scale)
+	{
+		static const std::array<uint8_t, ENCODE_LUT_SIZE> srgb_lut = BuildEncodeLUT(true);
+		static const std::array<uint8_t, ENCODE_LUT_SIZE> linear_lut = BuildEncodeLUT(false);
+		const uint8_t* lut = srgb ? srgb_lut.data() : linear_lut.data();
+
+		const glm::vec4* src = source + y * render_resolution.x;
+		uint32_t* dst = output_image + y * render_resolution.x;
+
+		if (depth_only) {
+			for (int x = 0; x < render_resolution.x; x++) {
+				dst[x] = ToUint(glm::vec4(src[x].w, src[x].w, src[x].w, 1.0f));
+			}
+			return;
+		}
+
+#ifdef MYPBRT_SSE
+		//one pixel per register, w holds depth and is ignored
+		const __m128 scale4 = _mm_set1_ps(scale);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 lut_scale = _mm_set1_ps((float)(ENCODE_LUT_SIZE - 1));
+		const __m128 half = _mm_set1_ps(0.5f);
+		alignas(16) int32_t index[4];
+
+		for (int x = 0; x < render_resolution.x; x++) {
+			__m128 c = _mm_mul_ps(_mm_loadu_ps(&src[x].x), scale4);
+			c = _mm_max_ps(c, zero);
+
+			switch (tone_mapping) {
+			case ToneMapping::Reinhard:
+				c = _mm_div_ps(c, _mm_add_ps(one, c));
+				break;
+			case ToneMapping::ACES: {
+				__m128 num = _mm_mul_ps(c, _mm_add_ps(_mm_mul_ps(c, _mm_set1_ps(2.51f)), _mm_set1_ps(0.03f)));
+				__m128 den = _mm_add_ps(_mm_mul_ps(c, _mm_add_ps(_mm_mul_ps(c, _mm_set1_ps(2.43f)), _mm_set1_ps(0.59f))), _mm_set1_ps(0.14f));
+				c = _mm_div_ps(num, den);
+				break;
+			}
+			default:
+				break;
+			}
+
+			c = _mm_min_ps(c, one);
+			_mm_store_si128((__m128i*)index, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, lut_scale), half)));
+			dst[x] = 0xff000000u | (lut[index[2]] << 16) | (lut[index[1]] << 8) | lut[index[0]];
+		}
+#else
+		for (int x = 0; x < render_resolution.x; x++) {
+			uint32_t pixel = 0xff000000u;
+			for (int c = 0; c < 3; c++) {
+				float value = ToneMap(glm::max(src[x][c] * scale, 0.0f), tone_mapping);
+				int index = (int)(glm::min(value, 1.0f) * (float)(ENCODE_LUT_SIZE - 1) + 0.5f);
+				pixel |= lut[index] << (c * 8);
+			}
+			dst[x] = pixel;
+		}
+#endif
+	}
+
 	void Integrator::DrawOverlays()
 	{
+		MYPBRT_TRACE_SCOPE("Integrator::DrawOverlays");
 		switch (overlay_type) {
 		case OverlayType::None:		
 			return;
@@ -374,7 +1107,38 @@ namespace MyPBRT {
 		switch (rendering_type) {
 		case MyPBRT::Integrator::RenderingType::PBR:
 			ImGui::DragInt("bounces", &bounces, 1, 0, std::numeric_limits<int>::max());
-			Texture::CreateTextureFromMenuFull(&selected_world_texture, &world_texture, world_texture_types);
+			ImGui::Checkbox("temporal reprojection", &temporal_reprojection);
+			if (ImGui::IsItemHovered())
+				ImGui::SetTooltip("keep samples while the camera moves");
+			if (temporal_reprojection) {
+				ImGui::DragInt("max history", &max_history_frames, 1, 0, 1024);
+			}
+			ImGui::Checkbox("dynamic resolution", &dynamic_resolution);
+			if (ImGui::IsItemHovered())
+				ImGui::SetTooltip("render fewer pixels while the camera moves to stay within the frame time");
+			if (dynamic_resolution) {
+				ImGui::DragFloat("target frame time (ms)", &target_frame_time, 0.1f, 1.0f, 1000.0f);
+				ImGui::DragFloat("min scale", &min_dynamic_scale, 0.01f, 0.01f, 1.0f);
+				ImGui::Text("current scale %.2f, %.1f ms", dynamic_scale, last_render_time);
+			}
+			ImGui::Checkbox("sort by material", &sort_by_material);
+			if (ImGui::IsItemHovered())
+				ImGui::SetTooltip("shade the hits of a whole bounce at once, grouped by material");
+			ImGui::Checkbox("denoise", &denoise);
+			if (denoise) {
+				ImGui::DragInt("denoise iterations", &denoise_iterations, 1, 1, 8);
+				ImGui::DragFloat("denoise strength", &denoise_strength, 0.01f, 0.0f, 100.0f);
+				if (ImGui::IsItemHovered())
+					ImGui::SetTooltip("how different two neighbouring pixels can be and still get blurred together");
+			}
+			{
+				std::shared_ptr<Texture> previous = world_texture;
+				Texture::CreateTextureFromMenuFull(&selected_world_texture, &world_texture, world_texture_types);
+				if (world_texture != previous) {
+					SetWorldTexture(world_texture);
+					ResetFrameIndex();
+				}
+			}
 			break;
 		case MyPBRT::Integrator::RenderingType::Rasterized:
 			ImGui::ColorEdit3("Cool", glm::value_ptr(gooch_cool));
@@ -386,6 +1150,44 @@ namespace MyPBRT {
 		}
 
 		ImGui::Text((std::to_string(frame) + " samples").c_str());
+		if (rendering_type == RenderingType::PBR && last_render_time > 0.0f) {
+			ImGui::SameLine();
+			ImGui::Text("%.1f ms, %.2f Mrays/s", last_render_time, last_frame_rays / (last_render_time * 1000.0f));
+		}
+#ifdef MYPBRT_STATS
+		if (rendering_type == RenderingType::PBR && ImGui::TreeNode("last frame")) {
+			for (int i = 0; i < COUNTER_COUNT; i++) {
+				ImGui::Text("%s: %llu", CounterName((Counter)i), (unsigned long long)frame_counters[i]);
+			}
+			uint64_t rays = frame_counters[(int)Counter::CameraRays] + frame_counters[(int)Counter::ShadowRays];
+			if (rays > 0) {
+				ImGui::Text("%.1f nodes, %.1f triangles per ray", (double)frame_counters[(int)Counter::BVHNodes] / rays, (double)frame_counters[(int)Counter::TriangleTests] / rays);
+			}
+			ImGui::TreePop();
+		}
+#endif
+
+		if (rendering_type == RenderingType::PBR) {
+			bool budget_changed = ImGui::DragInt("target samples", &target_samples, 1, 0, std::numeric_limits<int>::max());
+			budget_changed |= ImGui::DragFloat("time budget (s)", &time_budget, 0.1f, 0.0f, std::numeric_limits<float>::max());
+			budget_changed |= ImGui::DragFloat("noise threshold", &noise_threshold, 0.0005f, 0.0f, 1.0f, "%.4f");
+			if (ImGui::IsItemHovered())
+				ImGui::SetTooltip("stop once the average relative error of a pixel drops below this");
+			//loosening a budget continues the same image
+			if (budget_changed && Finished()) {
+				stop_reason = StopReason::None;
+				accumulation_start = std::chrono::steady_clock::now() - std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(finished_time));
+				CheckBudgets();
+			}
+			ImGui::Text("%s", GetReport().c_str());
+		}
+
+		ImGui::DragFloat("exposure", &exposure, 0.01f, -10.0f, 10.0f);
+		ImGui::Combo("Tone mapping", (int*)&tone_mapping, tone_mapping_options, IM_ARRAYSIZE(tone_mapping_options));
+		ImGui::Checkbox("sRGB", &srgb);
+		if (ImGui::IsItemHovered()) {
+			ImGui::SetTooltip("encode the output with the sRGB curve instead of writing linear values");
+		}
 
 		if (ImGui::DragFloat2("scale", glm::value_ptr(image_scale), .01, 0.01, 2)) {
 			OnResize(image_resolution);
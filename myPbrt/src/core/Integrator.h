@@ -5,9 +5,13 @@
 #include "Camera.h"
 #include "Sampler.h"
 #include "Texture.h"
+#include "Interaction.h"
+#include "Light.h"
+#include "Stats.h"
 
 #include <thread>
 #include <set>
+#include <chrono>
 
 namespace MyPBRT {
 
@@ -26,6 +30,12 @@ namespace MyPBRT {
 			All = 2
 		};
 
+		enum class ToneMapping {
+			None = 0,
+			Reinhard = 1,
+			ACES = 2
+		};
+
 		struct RasterPixel {
 			glm::vec2 uv;
 			glm::vec3 normal;
@@ -38,15 +48,74 @@ namespace MyPBRT {
 			float order;
 		};
 
+		//first surface a camera ray hits, used as guides for the denoiser
+		struct PrimaryHit {
+			glm::vec3 albedo = glm::vec3(0.0f);
+			glm::vec3 normal = glm::vec3(0.0f);
+			float depth = INFINITY;
+			//rays traced along the whole path, shadow rays included
+			uint32_t rays = 0;
+		};
+
+		enum class StopReason {
+			None = 0,
+			Samples = 1,
+			Time = 2,
+			Noise = 3
+		};
+
+		//samples [first_sample, first_sample + sample_count) of the pixels in [min, max), summed like image
+		struct Tile {
+			glm::ivec2 min = glm::ivec2(0);
+			glm::ivec2 max = glm::ivec2(0);
+			uint32_t first_sample = 0;
+			uint32_t sample_count = 0;
+			//w channel of color for depth
+			std::vector<glm::vec4> color;
+			std::vector<glm::vec4> albedo;
+			std::vector<glm::vec4> normal;
+		};
+
 		int bounces;
 		glm::vec2 image_scale = glm::vec2(1.0f);
 		
 		bool depth_only = false;
 
+		//traces all samples a bounce at a time and shades the hits of every bounce grouped by material
+		//instead of following each path to its end, gives the same image
+		bool sort_by_material = false;
+
+		bool denoise = false;
+		int denoise_iterations = 4;
+		float denoise_strength = 1.0f;
+
+		//keep the accumulated samples when the camera moves by reprojecting them into the new view
+		bool temporal_reprojection = false;
+		int max_history_frames = 16;
+
+		//scale the sampled resolution down while the camera moves to stay within target_frame_time (ms)
+		bool dynamic_resolution = false;
+		float target_frame_time = 33.0f;
+		float min_dynamic_scale = 0.25f;
+
+		//accumulation stops once any budget is reached, 0 turns it off
+		int target_samples = 0;
+		//seconds since the first sample
+		float time_budget = 0.0f;
+		//relative standard error of the pixel means, averaged over the image
+		float noise_threshold = 0.0f;
+
 		const char* rendering_options[3] = { "PBR", "Wireframe", "Rasterized" };
 		RenderingType rendering_type = RenderingType::PBR;
 		const char* overlay_options[3] = { "None", "Selection", "All" };
 		OverlayType overlay_type = OverlayType::Selection;
+		const char* tone_mapping_options[3] = { "None", "Reinhard", "ACES" };
+		const char* stop_reason_options[4] = { "", "target samples", "time budget", "noise threshold" };
+		ToneMapping tone_mapping = ToneMapping::None;
+
+		//in stops
+		float exposure = 0.0f;
+		bool srgb = true;
 
 		glm::vec3 gooch_warm = glm::vec3(0.8, 0.6, 0.6), gooch_cool = glm::vec3(0.1, 0.1, 0.3);
 		glm::vec3 wireframe_color = glm::vec3(0.0f);
@@ -56,13 +125,33 @@ namespace MyPBRT {
 
 	public:
 		Integrator(uint32_t _bounces, const glm::ivec2& _resolution, const glm::vec2& scale);
-		~Integrator() {}
+		~Integrator() { delete[] image; delete[] output_image; }
 		virtual void Predprocess(const Scene& scene, Sampler& sampler) {}
 		void Render(const Scene& scene, const Camera& camera);
-		glm::vec3 TraceRay(Ray* ray, int depth = 0) const;
-		void ResetFrameIndex() { frame = 0; }
+		glm::vec3 TraceRay(Ray* ray, int depth = 0, PrimaryHit* primary = nullptr) const;
+		void ResetFrameIndex() { frame = 0; reproject_pending = false; }
+		//either throws the accumulated image away or keeps it around for reprojection
+		void CameraMoved();
 		void OnResize(const glm::ivec2& size);
 		uint32_t* GetImage(bool overlays = true);
+		//averaged linear radiance with exposure applied, denoised if enabled
+		std::vector<glm::vec3> GetRadiance();
+		uint32_t GetFrameIndex() const { return frame; }
+		void SetFrameIndex(uint32_t _frame) { frame = _frame; }
+		//set once a budget is reached, the image then stays as it is until the frame index is reset
+		bool Finished() const { return stop_reason != StopReason::None; }
+		StopReason GetStopReason() const { return stop_reason; }
+		//seconds spent accumulating the current image
+		float GetRenderTime() const;
+		uint64_t GetRayCount() const { return ray_count; }
+		//negative until there are enough samples to tell
+		float GetNoiseEstimate() const { return noise_estimate; }
+		//ex. "256 spp in 10.2 s, 3.1 Mrays/s, stopped by the time budget"
+		std::string GetReport() const;
+		//renders at full resolution with the same random numbers a local render of those frames would use
+		void RenderTile(const Scene& scene, const Camera& camera, Tile& tile);
+		//adds the tile to the accumulated image, the frame index has to be set to the total sample count afterwards
+		void MergeTile(const Tile& tile);
 		void Clear();
 
 		void RenderRayTraced();
@@ -77,28 +166,117 @@ namespace MyPBRT {
 		const glm::ivec2& Resolution() const { return image_resolution; }
 
 		std::weak_ptr<Texture> GetWorldTexture() { return world_texture; }
+		void SetWorldTexture(std::shared_ptr<Texture> texture);
 
 	private:
-		glm::ivec2 render_resolution;
+		//everything a path carries from one bounce to the next, so the bounces of many paths can be interleaved
+		struct PathState {
+			Ray ray;
+			SurfaceInteraction interaction;
+			//light that ended the path or stands in for a ray that would have, weighted by the contribution at that point
+			glm::vec3 color = glm::vec3(0.0f);
+			//light of the spherical lights, weighted by the contribution of the whole path
+			glm::vec3 light_color = glm::vec3(0.0f);
+			glm::vec3 contribution = glm::vec3(1.0f);
+			float prev_pdf = 1;
+			//whether the last surface also sampled the environment and emissive objects directly
+			//then whatever the ray it scattered hits of them only counts for its share
+			bool lights_sampled = false;
+			int depth = 0;
+			PrimaryHit primary;
+			//only used while the path waits for the other ones of its bounce
+			RandomStream random;
+
+			PathState() { interaction.wo = glm::vec3(-1.0f); }
+			glm::vec3 Radiance() const { return color + light_color * glm::clamp(contribution, 0.0f, 1.0f); }
+		};
+
+		glm::ivec2 render_resolution{ 0 };
 		glm::ivec2 image_resolution;
 		uint32_t frame = 0;
 
 		bool draw_overlays = true;
 
 		//w channel for depth
-		glm::vec4* image;
-		uint32_t* output_image;
+		glm::vec4* image = nullptr;
+		uint32_t* output_image = nullptr;
+
+		//accumulated like image, w unused
+		std::vector<glm::vec4> albedo_buffer;
+		std::vector<glm::vec4> normal_buffer;
+		//ping pong targets of the denoiser, w channel for depth
+		std::vector<glm::vec4> denoise_buffers[2];
+
+		//accumulation of the previous view, w channel for depth
+		std::vector<glm::vec4> history_buffer;
+		uint32_t history_frames = 0;
+		bool reproject_pending = false;
+		//camera the accumulated image was rendered with
+		glm::mat4 rendered_view_projection{ 1.0f };
+		glm::vec3 rendered_camera_position{ 0.0f };
 
-		const Camera* active_camera;
-		const Scene* active_scene;
+		//fraction of render_resolution that is actually sampled, the buffers stay full size
+		float dynamic_scale = 1.0f;
+		float last_render_time = 0.0f;
+		bool camera_moved = false;
+
+		StopReason stop_reason = StopReason::None;
+		std::chrono::steady_clock::time_point accumulation_start;
+		float finished_time = 0.0f;
+		uint64_t ray_count = 0;
+		uint64_t last_frame_rays = 0;
+		//what the last frame did, all zero without MYPBRT_STATS
+		CounterValues frame_counters = {};
+		//sum of luminance and its square per pixel since the last reset
+		std::vector<glm::vec2> luminance_moments;
+		uint32_t moment_samples = 0;
+		float noise_estimate = -1.0f;
+
+		const Camera* active_camera = nullptr;
+		const Scene* active_scene = nullptr;
 	
 		std::vector<uint32_t> height_iterator, width_iterator;
 
 		std::shared_ptr<Texture> world_texture;
 		std::vector<Texture::TextureType> world_texture_types = { Texture::TextureType::ConstantColor, Texture::TextureType::Image };
 		int selected_world_texture = 0;
+		//importance samples the world texture, nullptr if it is not an image
+		std::shared_ptr<EnvironmentLight> environment;
+
+		//paths of the rows sort_by_material traces at once and the indices of the ones still going
+		std::vector<PathState> wave_paths;
+		std::vector<uint32_t> wave_active;
+		//active paths sorted by the material they hit, with the key of every one and where the run of every material starts
+		std::vector<uint32_t> wave_sorted;
+		std::vector<uint32_t> wave_keys;
+		std::vector<uint32_t> wave_offsets;
+		std::vector<uint8_t> wave_alive;
 
 	private:
+		//camera sample through cell of a lattice whose cells are block_size pixels large
+		glm::vec3 TraceCameraSample(const glm::uvec2& cell, uint32_t cells_per_row, uint32_t sample, const glm::vec2& block_size, PrimaryHit* primary) const;
+		//seeds the random stream of the sample and sets up its camera ray
+		void StartCameraPath(PathState& path, const glm::uvec2& cell, uint32_t cells_per_row, uint32_t sample, const glm::vec2& block_size) const;
+		//follows the path to its end
+		void TracePath(PathState& path) const;
+		//starts the next bounce, false if the ray left the scene
+		bool IntersectPath(PathState& path) const;
+		//ends the path with what the ray sees of the world
+		void ShadeMiss(PathState& path) const;
+		//light and scattering at the hit, false once the path ends, material is nullptr when the scene has none
+		bool ShadeHit(PathState& path, const MaterialRecord* material) const;
+		const MaterialRecord* HitMaterial(const SurfaceInteraction& interaction) const;
+		//renders the frame with sort_by_material, returns the rays it traced
+		uint64_t RenderSortedByMaterial(const glm::ivec2& samples, const glm::vec2& block_size);
+		void AccumulateSample(const glm::uvec2& cell, const glm::vec2& block_size, const glm::vec3& light, const PrimaryHit& primary);
+		void ResolveRow(const glm::vec4* source, uint32_t y, float scale);
+		const glm::vec4* Denoise();
+		void Reproject();
+		void DiscardOrKeepHistory();
+		void UpdateDynamicScale();
+		void EstimateNoise();
+		void CheckBudgets();
+		glm::ivec2 SampleResolution() const;
 		void DrawOverlays();
 
 		IntegratorSetPixelFunctionPtr set_pixel_uint32 = [this](uint32_t x, uint32_t y, glm::vec4 c) {	output_image[x + y * render_resolution.x] = ToUint(c); };
@@ -26,7 +26,13 @@ namespace MyPBRT {
 		glm::vec2 uv = glm::vec2(0.0f);
 		int shape;
 		int primitive = -1;
+		//index of the hit triangle in its mesh
+		int triangle = -1;
 		bool front_face = true;
+		//width of the ray cone at the hit in uv units, 0 samples the full resolution texture
+		float uv_footprint = 0;
+		//uv units per world unit of the hit triangle
+		float uv_scale = 0;
 
 	public:
 		void SetNormal(const glm::vec3& _rayDirection, const glm::vec3& _normal) {
@@ -34,6 +40,12 @@ namespace MyPBRT {
 			normal = front_face ? _normal : -_normal;
 			normal = _normal;
 		}
+
+		//footprint of a cone that is cone_width wide where it hits, wider when it hits at an angle
+		void SetFootprint(float cone_width, const glm::vec3& direction) {
+			float cos_theta = glm::abs(glm::dot(normal, direction)) / (glm::length(normal) * glm::length(direction));
+			uv_footprint = uv_scale * cone_width / std::max(cos_theta, 0.01f);
+		}
 	};
 
 }
\ No newline at end of file
@@ -3,6 +3,11 @@
 #include "imgui.h"
 #include "Interaction.h"
 #include "Camera.h"
+#include "Texture.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <execution>
 
 namespace MyPBRT {
 
@@ -123,4 +128,127 @@ namespace MyPBRT {
 		return "Spherical";
 	}
 
+	std::shared_ptr<EnvironmentLight> EnvironmentLight::Create(std::shared_ptr<Texture> texture)
+	{
+		MYPBRT_TRACE_SCOPE("EnvironmentLight::Create");
+		const ImageTexture* image = dynamic_cast<const ImageTexture*>(texture.get());
+		if (!image) {
+			return nullptr;
+		}
+
+		std::shared_ptr<EnvironmentLight> ret = std::make_shared<EnvironmentLight>();
+		ret->texture = texture;
+		//a cell per texel up to a size where building it stays quick, coarser cells only make the pdf a bit flatter
+		ret->width = std::min<uint32_t>(image->width, 1024);
+		ret->height = std::min<uint32_t>(image->height, 512);
+		uint32_t width = ret->width, height = ret->height;
+
+		std::vector<double> weights((size_t)width * height);
+		std::vector<uint32_t> row_indices(height);
+		for (uint32_t y = 0; y < height; y++) row_indices[y] = y;
+		std::for_each(std::execution::par, row_indices.begin(), row_indices.end(), [&](uint32_t y) {
+			SurfaceInteraction interaction;
+			//whole cells are averaged so small bright spots aren't missed between cell centers
+			interaction.uv_footprint = 1.0f / height;
+			//rows near the poles cover less of the sphere
+			double sin_theta = std::sin(PI * (y + 0.5) / height);
+			for (uint32_t x = 0; x < width; x++) {
+				interaction.uv = glm::vec2((x + 0.5f) / width, (y + 0.5f) / height);
+				glm::vec3 color = glm::max(glm::vec3(texture->Evaluate(interaction)), glm::vec3(0.0f));
+				weights[x + (size_t)y * width] = glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f)) * sin_theta;
+			}
+			});
+
+		ret->rows.resize(height + 1);
+		ret->cells.resize((size_t)(width + 1) * height);
+		ret->cell_pdfs.resize((size_t)width * height);
+		std::vector<double> row_sums(height);
+		double total = 0;
+		for (uint32_t y = 0; y < height; y++) {
+			const double* row = &weights[(size_t)y * width];
+			float* cdf = &ret->cells[(size_t)y * (width + 1)];
+			double sum = 0;
+			for (uint32_t x = 0; x < width; x++) sum += row[x];
+			double partial = 0;
+			for (uint32_t x = 0; x <= width; x++) {
+				//black rows are never picked, their cdf only has to be valid
+				cdf[x] = sum > 0 ? (float)(partial / sum) : (float)x / width;
+				if (x < width) partial += row[x];
+			}
+			cdf[width] = 1.0f;
+			row_sums[y] = sum;
+			total += sum;
+		}
+		if (!(total > 0)) {
+			return nullptr;
+		}
+
+		double partial = 0;
+		for (uint32_t y = 0; y <= height; y++) {
+			ret->rows[y] = (float)(partial / total);
+			if (y < height) partial += row_sums[y];
+		}
+		ret->rows[height] = 1.0f;
+		for (size_t i = 0; i < weights.size(); i++) {
+			ret->cell_pdfs[i] = (float)(weights[i] / total * width * height);
+		}
+		return ret;
+	}
+
+	glm::vec2 EnvironmentLight::DirectionToUV(const glm::vec3& direction)
+	{
+		float theta = acos(glm::clamp(-direction.y, -1.0f, 1.0f));
+		float phi = atan2(-direction.z, direction.x) + PIf;
+		return glm::vec2(phi / (2.0f * PIf), theta / PIf);
+	}
+
+	glm::vec3 EnvironmentLight::UVToDirection(const glm::vec2& uv)
+	{
+		float theta = uv.y * PIf;
+		float phi = uv.x * 2.0f * PIf;
+		float sin_theta = sin(theta);
+		return glm::vec3(-cos(phi) * sin_theta, -cos(theta), sin(phi) * sin_theta);
+	}
+
+	//index of the interval of the cdf that value falls into and where in it, from 0 to 1
+	static uint32_t SampleCDF(const float* cdf, uint32_t count, float value, float* fraction)
+	{
+		uint32_t i = (uint32_t)(std::upper_bound(cdf, cdf + count + 1, value) - cdf);
+		i = glm::clamp(i, 1u, count) - 1;
+		float size = cdf[i + 1] - cdf[i];
+		*fraction = size > 0 ? glm::clamp((value - cdf[i]) / size, 0.0f, 1.0f) : 0.5f;
+		return i;
+	}
+
+	glm::vec3 EnvironmentLight::Sample(float* pdf) const
+	{
+		float u1 = random_double(), u2 = random_double();
+		float dy, dx;
+		uint32_t y = SampleCDF(rows.data(), height, u1, &dy);
+		uint32_t x = SampleCDF(&cells[(size_t)y * (width + 1)], width, u2, &dx);
+
+		glm::vec2 uv((x + dx) / width, (y + dy) / height);
+		float sin_theta = sin(uv.y * PIf);
+		//the unit square maps to 2pi * pi radians, stretched by 1 / sin(theta) away from the equator
+		*pdf = sin_theta > 0 ? cell_pdfs[x + (size_t)y * width] / (2.0f * PIf * PIf * sin_theta) : 0.0f;
+		return UVToDirection(uv);
+	}
+
+	float EnvironmentLight::PDF_Value(const glm::vec3& direction) const
+	{
+		glm::vec3 d = glm::normalize(direction);
+		glm::vec2 uv = DirectionToUV(d);
+		uint32_t x = std::min((uint32_t)(uv.x * width), width - 1);
+		uint32_t y = std::min((uint32_t)(uv.y * height), height - 1);
+		float sin_theta = sqrt(std::max(0.0f, 1.0f - d.y * d.y));
+		return sin_theta > 0 ? cell_pdfs[x + (size_t)y * width] / (2.0f * PIf * PIf * sin_theta) : 0.0f;
+	}
+
+	glm::vec3 EnvironmentLight::Evaluate(const glm::vec3& direction) const
+	{
+		SurfaceInteraction interaction;
+		interaction.uv = DirectionToUV(glm::normalize(direction));
+		return glm::vec3(texture->Evaluate(interaction));
+	}
+
 }
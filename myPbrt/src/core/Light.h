@@ -44,11 +44,38 @@ namespace MyPBRT {
 	
 		void DeSerialize(const Json::Value& node) override;
 		Json::Value Serialize() const override;
-		std::string GetType() const override;
+		std::string GetType() const;
 
 	private:
 		glm::vec3 position = glm::vec3(0);
 		float radius = 0;
 	};
+
+	//the world texture as a light, directions are picked in proportion to the luminance of the texels they see
+	//the texture is read once into a grid of cells, a cdf over its rows and one over the cells of every row
+	class EnvironmentLight {
+	public:
+		//nullptr if the texture has nothing worth sampling, ex. black or not an image
+		static std::shared_ptr<EnvironmentLight> Create(std::shared_ptr<Texture> texture);
+		//the equirectangular mapping world textures are looked up with
+		static glm::vec2 DirectionToUV(const glm::vec3& direction);
+		static glm::vec3 UVToDirection(const glm::vec2& uv);
+
+		//unit direction towards the environment, pdf is per solid angle
+		glm::vec3 Sample(float* pdf) const;
+		float PDF_Value(const glm::vec3& direction) const;
+		glm::vec3 Evaluate(const glm::vec3& direction) const;
+
+	private:
+		std::shared_ptr<Texture> texture;
+		uint32_t width = 0;
+		uint32_t height = 0;
+		//height + 1 values going from 0 to 1
+		std::vector<float> rows;
+		//width + 1 values per row
+		std::vector<float> cells;
+		//pdf of a cell over the unit square, divided by its share of the sphere when turned into solid angle
+		std::vector<float> cell_pdfs;
+	};
 }
 
@@ -0,0 +1,91 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace MyPBRT {
+
+#ifdef _WIN32
+
+	std::shared_ptr<MappedFile> MappedFile::Open(const std::string& path)
+	{
+		std::shared_ptr<MappedFile> ret(new MappedFile());
+		ret->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (ret->file == INVALID_HANDLE_VALUE) {
+			ret->file = nullptr;
+			return nullptr;
+		}
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(ret->file, &size)) {
+			return nullptr;
+		}
+		ret->size = (size_t)size.QuadPart;
+		//empty files can't be mapped, they are still valid files though
+		if (ret->size == 0) {
+			return ret;
+		}
+
+		ret->mapping = CreateFileMappingA(ret->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!ret->mapping) {
+			return nullptr;
+		}
+		ret->data = (const uint8_t*)MapViewOfFile(ret->mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!ret->data) {
+			return nullptr;
+		}
+		return ret;
+	}
+
+	MappedFile::~MappedFile()
+	{
+		if (data) UnmapViewOfFile(data);
+		if (mapping) CloseHandle(mapping);
+		if (file) CloseHandle(file);
+	}
+
+#else
+
+	std::shared_ptr<MappedFile> MappedFile::Open(const std::string& path)
+	{
+		std::shared_ptr<MappedFile> ret(new MappedFile());
+		ret->file = open(path.c_str(), O_RDONLY);
+		if (ret->file < 0) {
+			return nullptr;
+		}
+
+		struct stat info;
+		if (fstat(ret->file, &info) != 0) {
+			return nullptr;
+		}
+		ret->size = (size_t)info.st_size;
+		//empty files can't be mapped, they are still valid files though
+		if (ret->size == 0) {
+			return ret;
+		}
+
+		void* data = mmap(nullptr, ret->size, PROT_READ, MAP_PRIVATE, ret->file, 0);
+		if (data == MAP_FAILED) {
+			return nullptr;
+		}
+		ret->data = (const uint8_t*)data;
+		return ret;
+	}
+
+	MappedFile::~MappedFile()
+	{
+		if (data) munmap((void*)data, size);
+		if (file >= 0) close(file);
+	}
+
+#endif
+
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "core.h"
+
+//read only view of a whole file, pages are only read from disk once they are touched
+
+namespace MyPBRT {
+
+	class MappedFile
+	{
+	public:
+		//nullptr if the file can't be opened or mapped
+		static std::shared_ptr<MappedFile> Open(const std::string& path);
+
+		~MappedFile();
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		const uint8_t* Data() const { return data; }
+		size_t Size() const { return size; }
+
+	private:
+		MappedFile() = default;
+
+		const uint8_t* data = nullptr;
+		size_t size = 0;
+#ifdef _WIN32
+		void* file = nullptr;
+		void* mapping = nullptr;
+#else
+		int file = -1;
+#endif
+	};
+
+}
@@ -23,10 +23,20 @@ namespace MyPBRT {
 	}
 
 	bool DiffuseMaterial::ScatterRay(const SurfaceInteraction& interaction, glm::vec3& dir, bool& has_pdf) const
+	{
+		return Scatter(roughness, interaction, dir, has_pdf);
+	}
+
+	bool DiffuseMaterial::Scatter(float roughness, const SurfaceInteraction& interaction, glm::vec3& dir, bool& has_pdf)
 	{
 		if (random_double(0, 1) < roughness) {
 			has_pdf = true;
-			dir = random_cosine_direction();
+			//cosine weighted around the normal, the pdf Pdf_Value gives
+			glm::vec3 local = random_cosine_direction();
+			glm::vec3 a = (fabs(interaction.normal.x) > 0.9) ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0);
+			glm::vec3 v = glm::normalize(glm::cross(interaction.normal, a));
+			glm::vec3 u = glm::cross(interaction.normal, v);
+			dir = local.x * u + local.y * v + local.z * interaction.normal;
 		}
 		else {
 			dir = glm::reflect(glm::normalize(dir), interaction.normal);
@@ -39,6 +49,16 @@ namespace MyPBRT {
 		return true;
 	}
 
+	MaterialRecord DiffuseMaterial::Compile() const
+	{
+		MaterialRecord record;
+		record.type = MaterialRecord::Type::Diffuse;
+		record.has_pdf = has_pdf;
+		record.roughness = roughness;
+		record.texture = TextureRef(texture.get(), glm::vec4(1, 0, 1, 0));
+		return record;
+	}
+
 	void DiffuseMaterial::IMGUI_Edit()
 	{
 		ImGui::DragFloat("roguhness", &roughness, .1, 0, 1);
@@ -98,6 +118,17 @@ namespace MyPBRT {
 		return false;
 	}
 
+	MaterialRecord EmissiveMaterial::Compile() const
+	{
+		MaterialRecord record;
+		record.type = MaterialRecord::Type::Emissive;
+		record.has_pdf = has_pdf;
+		//without a texture EvaluateLight gives white whatever the emission is
+		record.emission = texture ? emission : glm::vec3(1.0f);
+		record.texture = TextureRef(texture.get(), glm::vec4(1.0f));
+		return record;
+	}
+
 	void EmissiveMaterial::IMGUI_Edit()
 	{
 		ImGui::ColorEdit3("emission", glm::value_ptr(emission));
@@ -129,7 +160,7 @@ namespace MyPBRT {
 		Material::DeSerialize(node);
 		int i = 0;
 		for (auto& value : node["emission"]) {
-			emission[i] = value.asFloat();
+			emission[i++] = value.asFloat();
 		}
 		if (node["texture"].isNull() == false)
 			texture = Texture::ParseTexture(node["texture"]);
@@ -156,6 +187,11 @@ namespace MyPBRT {
 	}
 
 	bool MetallicMaterial::ScatterRay(const SurfaceInteraction& interaction, glm::vec3& dir, bool& has_pdf) const
+	{
+		return Scatter(roughness, interaction, dir, has_pdf);
+	}
+
+	bool MetallicMaterial::Scatter(float roughness, const SurfaceInteraction& interaction, glm::vec3& dir, bool& has_pdf)
 	{
 		dir = glm::reflect(glm::normalize(dir), interaction.normal);
 		if (random_double(0, 1) < roughness) {
@@ -170,6 +206,16 @@ namespace MyPBRT {
 		return true;
 	}
 
+	MaterialRecord MetallicMaterial::Compile() const
+	{
+		MaterialRecord record;
+		record.type = MaterialRecord::Type::Metallic;
+		record.has_pdf = has_pdf;
+		record.roughness = roughness;
+		record.texture = TextureRef(texture.get(), glm::vec4(1, 0, 1, 0));
+		return record;
+	}
+
 	void MetallicMaterial::IMGUI_Edit()
 	{
 		ImGui::DragFloat("roughness", &roughness, 0.01, 0, 1);
@@ -244,6 +290,11 @@ namespace MyPBRT {
 	}
 
 	bool GlassMaterial::ScatterRay(const SurfaceInteraction& interaction, glm::vec3& dir, bool& has_pdf) const
+	{
+		return Scatter(ior, roughness_map->Evaluate(interaction).x, interaction, dir, has_pdf);
+	}
+
+	bool GlassMaterial::Scatter(float ior, float roughness, const SurfaceInteraction& interaction, glm::vec3& dir, bool& has_pdf)
 	{
 		glm::vec3 unit_direction = glm::normalize(dir);
 		float refraction_ratio = glm::dot(unit_direction, interaction.normal) < 0 ? (1.0 / ior) : ior;
@@ -256,7 +307,6 @@ namespace MyPBRT {
 			dir = glm::refract(unit_direction, interaction.normal, refraction_ratio);
 		dir = glm::refract(unit_direction, interaction.normal, refraction_ratio);
 
-		float roughness = roughness_map->Evaluate(interaction).x;
 		if (random_double(0, 1) < roughness) {
 			has_pdf = true;
 			dir = glm::normalize(random_cosine_direction() + dir);
@@ -265,6 +315,16 @@ namespace MyPBRT {
 		return true;
 	}
 
+	MaterialRecord GlassMaterial::Compile() const
+	{
+		MaterialRecord record;
+		record.type = MaterialRecord::Type::Glass;
+		record.has_pdf = has_pdf;
+		record.ior = ior;
+		record.texture = TextureRef(roughness_map.get(), glm::vec4(0.0f));
+		return record;
+	}
+
 	void GlassMaterial::IMGUI_Edit()
 	{
 		ImGui::DragFloat("ior", &ior, 0.01, 0, std::numeric_limits<float>::max());
@@ -314,6 +374,20 @@ namespace MyPBRT {
 		return ret;
 	}
 
+	bool MaterialRecord::ScatterRay(const SurfaceInteraction& interaction, glm::vec3& dir, bool& has_pdf) const
+	{
+		switch (type) {
+		case Type::Diffuse:
+			return DiffuseMaterial::Scatter(roughness, interaction, dir, has_pdf);
+		case Type::Metallic:
+			return MetallicMaterial::Scatter(roughness, interaction, dir, has_pdf);
+		case Type::Glass:
+			return GlassMaterial::Scatter(ior, texture.Evaluate(interaction).x, interaction, dir, has_pdf);
+		default:
+			return false;
+		}
+	}
+
 	void Material::DeSerialize(const Json::Value& node)
 	{
 		has_pdf = node["has pdf"].asBool();
@@ -9,6 +9,46 @@
 
 namespace MyPBRT{
 
+    //a material flattened into plain data, shading switches on the type instead of calling through the material and its textures
+    //Scene::Preprocess compiles one per material, the textures stay owned by the materials
+    struct MaterialRecord {
+        enum class Type : uint8_t {
+            Diffuse = 0,
+            Emissive = 1,
+            Metallic = 2,
+            Glass = 3
+        };
+
+        Type type = Type::Diffuse;
+        bool has_pdf = false;
+        float roughness = 0.0f;
+        float ior = 1.0f;
+        glm::vec3 emission = glm::vec3(0.0f);
+        //color of diffuse and metallic, tint of the emission and roughness of glass
+        TextureRef texture;
+
+        //small enough to be inlined into the integrator, unlike the virtual functions of Material
+        glm::vec3 Evaluate(const SurfaceInteraction& interaction) const {
+            if (type == Type::Diffuse || type == Type::Metallic) {
+                glm::vec4 tex = texture.Evaluate(interaction);
+                return glm::vec3(tex.x, tex.y, tex.z);
+            }
+            return glm::vec3(1.0f);
+        }
+        glm::vec3 EvaluateLight(const SurfaceInteraction& interaction) const {
+            if (type != Type::Emissive) return glm::vec3(0.0f);
+            glm::vec4 tex = texture.Evaluate(interaction);
+            return emission * glm::vec3(tex.x, tex.y, tex.z);
+        }
+        float Pdf_Value(const glm::vec3& direction, const glm::vec3& normal) const {
+            float cosine_theta = glm::dot(glm::normalize(direction), normal);
+            if (type == Type::Diffuse || type == Type::Metallic) return fmax(0, cosine_theta * INVPIf);
+            if (type == Type::Glass) return glm::abs(cosine_theta) * INVPIf;
+            return 0.0f;
+        }
+        bool ScatterRay(const SurfaceInteraction& interaction, glm::vec3& dir, bool& has_pdf) const;
+    };
+
     class Material : public Serializable{
     public:
         bool has_pdf = false;
@@ -18,6 +58,7 @@ namespace MyPBRT{
         virtual bool ScatterRay(const SurfaceInteraction& interaction, glm::vec3& dir, bool& has_pdf) const = 0;
         virtual void IMGUI_Edit() = 0;
         virtual float Pdf_Value(const glm::vec3& direction, const glm::vec3& normal) const = 0;
+        virtual MaterialRecord Compile() const = 0;
     
         virtual void DeSerialize(const Json::Value& node) override;
         virtual Json::Value Serialize() const override;
@@ -40,6 +81,7 @@ namespace MyPBRT{
         void IMGUI_Edit();
         static void IMGUI_Create(Scene* scene);
         float Pdf_Value(const glm::vec3& direction, const glm::vec3& normal) const;
+        MaterialRecord Compile() const override;
 
         void DeSerialize(const Json::Value& node) override;
         Json::Value Serialize() const override;
@@ -65,6 +107,9 @@ namespace MyPBRT{
         void IMGUI_Edit();
         static void IMGUI_Create(Scene* scene);
         float Pdf_Value(const glm::vec3& direction, const glm::vec3& normal) const;
+        MaterialRecord Compile() const override;
+        //ScatterRay with the parameters passed in, the material table scatters with it too
+        static bool Scatter(float roughness, const SurfaceInteraction& interaction, glm::vec3& dir, bool& has_pdf);
 
         void DeSerialize(const Json::Value& node) override;
         Json::Value Serialize() const override;
@@ -89,6 +134,8 @@ namespace MyPBRT{
         void IMGUI_Edit();
         static void IMGUI_Create(Scene* scene);
         float Pdf_Value(const glm::vec3& direction, const glm::vec3& normal) const;
+        MaterialRecord Compile() const override;
+        static bool Scatter(float roughness, const SurfaceInteraction& interaction, glm::vec3& dir, bool& has_pdf);
 
         void DeSerialize(const Json::Value& node) override;
         Json::Value Serialize() const override;
@@ -114,6 +161,8 @@ namespace MyPBRT{
         void IMGUI_Edit();
         static void IMGUI_Create(Scene* scene);
         float Pdf_Value(const glm::vec3& direction, const glm::vec3& normal) const;
+        MaterialRecord Compile() const override;
+        static bool Scatter(float ior, float roughness, const SurfaceInteraction& interaction, glm::vec3& dir, bool& has_pdf);
 
         void DeSerialize(const Json::Value& node) override;
         Json::Value Serialize() const override;
@@ -3,6 +3,8 @@
 #include "Interaction.h"
 #include "Camera.h"
 #include "Texture.h"
+#include "Stats.h"
+#include "Trace.h"
 
 #include <imgui.h>
 #include <set>
@@ -20,7 +22,7 @@ namespace MyPBRT {
 
     std::shared_ptr<Mesh> Mesh::ParseMesh(const Json::Value& node)
     {
-        std::shared_ptr<Mesh> ret(new Mesh({}, {}));
+        std::shared_ptr<Mesh> ret(new Mesh(Geometry()));
         ret->DeSerialize(node);
         return ret;
     }
@@ -156,10 +158,49 @@ namespace MyPBRT {
     //    return  1 / solid_angle;
     //}
    */
+    Mesh::Geometry Mesh::Geometry::Own(std::vector<glm::vec3>&& positions, std::vector<glm::vec3>&& normals, std::vector<glm::vec2>&& uvs, std::vector<uint32_t>&& indices)
+    {
+        struct Buffers {
+            std::vector<glm::vec3> positions;
+            std::vector<glm::vec3> normals;
+            std::vector<glm::vec2> uvs;
+            std::vector<uint32_t> indices;
+        };
+        std::shared_ptr<Buffers> buffers(new Buffers{ std::move(positions), std::move(normals), std::move(uvs), std::move(indices) });
+
+        Geometry ret;
+        ret.positions = buffers->positions.data();
+        ret.normals = buffers->normals.data();
+        ret.uvs = buffers->uvs.data();
+        ret.indices = buffers->indices.data();
+        ret.vertex_count = (uint32_t)buffers->positions.size();
+        ret.index_count = (uint32_t)buffers->indices.size();
+        ret.storage = buffers;
+        return ret;
+    }
     Mesh::Mesh(const std::vector<Vertex>& _vertices, const std::vector<uint32_t>& _indices)
-        : vertices(_vertices), indices(_indices) {
+    {
+        std::vector<glm::vec3> positions(_vertices.size()), normals(_vertices.size());
+        std::vector<glm::vec2> uvs(_vertices.size());
+        for (int i = 0; i < _vertices.size(); i++) {
+            positions[i] = _vertices[i].position;
+            normals[i] = _vertices[i].normal;
+            uvs[i] = _vertices[i].uv;
+        }
+        SetGeometry(Geometry::Own(std::move(positions), std::move(normals), std::move(uvs), std::vector<uint32_t>(_indices)));
+    }
+    Mesh::Mesh(const Geometry& _geometry)
+    {
+        SetGeometry(_geometry);
+    }
+    void Mesh::SetGeometry(const Geometry& _geometry)
+    {
+        geometry = _geometry;
+        const uint32_t* indices = geometry.indices;
+
+        edges.clear();
         std::unordered_map<int, int> edgesMap;
-        for (int i = 0; i < indices.size(); i += 3) {
+        for (int i = 0; i < geometry.index_count; i += 3) {
             edgesMap[indices[i]] = indices[i + 1];
             edgesMap[indices[i+1]] = indices[i + 2];
             edgesMap[indices[i+2]] = indices[i];
@@ -180,7 +221,9 @@ namespace MyPBRT {
     {
         bool hit = false;
 
-        for (int i = 0; i < indices.size(); i += 3) {
+        const uint32_t* indices = geometry.indices;
+        for (int i = 0; i < geometry.index_count; i += 3) {
+            MYPBRT_COUNT(TriangleTests);
             const uint32_t i0 = indices[i], i1 = indices[i + 1], i2 = indices[i + 2];
             const Vertex* v0 = &transformed_vertices[i0], * v1 = &transformed_vertices[i1], * v2 = &transformed_vertices[i2];
             const glm::vec3 normal = v0->normal;
@@ -246,7 +289,40 @@ namespace MyPBRT {
     }
     float Mesh::Area() const
     {
-        return 0.0f;
+        return total_area;
+    }
+    void Mesh::BuildAreaTable()
+    {
+        if (!area_table.Valid()) {
+            area_table = AliasTable(triangle_areas);
+        }
+    }
+    SurfaceInteraction Mesh::SamplePoint() const
+    {
+        int triangle = area_table.Sample(random_double());
+        const uint32_t* indices = geometry.indices;
+        const Vertex* v0 = &transformed_vertices[indices[triangle * 3]], * v1 = &transformed_vertices[indices[triangle * 3 + 1]], * v2 = &transformed_vertices[indices[triangle * 3 + 2]];
+
+        //the square root keeps the points from bunching up in the corner of v0
+        float r = sqrt(random_double());
+        float b0 = 1 - r;
+        float b1 = r * random_double();
+        float b2 = 1 - b0 - b1;
+
+        SurfaceInteraction ret;
+        ret.pos = b0 * v0->position + b1 * v1->position + b2 * v2->position;
+        ret.uv = b0 * v0->uv + b1 * v1->uv + b2 * v2->uv;
+        ret.normal = TriangleNormal(triangle);
+        ret.triangle = triangle;
+        return ret;
+    }
+    glm::vec3 Mesh::TriangleNormal(int triangle) const
+    {
+        const uint32_t* indices = geometry.indices;
+        const glm::vec3& p0 = transformed_vertices[indices[triangle * 3]].position;
+        const glm::vec3& p1 = transformed_vertices[indices[triangle * 3 + 1]].position;
+        const glm::vec3& p2 = transformed_vertices[indices[triangle * 3 + 2]].position;
+        return glm::normalize(glm::cross(p1 - p0, p2 - p0));
     }
     bool Mesh::CreateIMGUI()
     {
@@ -262,6 +338,9 @@ namespace MyPBRT {
 
         const std::vector<Texture::TextureType> normal_map_texture_types = { Texture::TextureType::Image };
         Texture::CreateTextureFromMenuFull(&selected_normal_map_texture, &normal_map, normal_map_texture_types);
+        if (normal_map) {
+            normal_map->DecodeNormals();
+        }
         ImGui::DragFloat("normal map strength", &normal_map_strength, .01, 0, std::numeric_limits<float>::max());
         if (changed) {
             ApplyTransformation();
@@ -320,7 +399,9 @@ namespace MyPBRT {
     }
     bool Mesh::IntersectTriangle(const Ray& ray, SurfaceInteraction* interaction, int object) const
     {
+        MYPBRT_COUNT(TriangleTests);
         object *= 3;
+        const uint32_t* indices = geometry.indices;
         const uint32_t i0 = indices[object], i1 = indices[object + 1], i2 = indices[object + 2];
         const Vertex* v0 = &transformed_vertices[i0], * v1 = &transformed_vertices[i1], * v2 = &transformed_vertices[i2];
 
@@ -383,12 +464,17 @@ namespace MyPBRT {
 
         interaction->uv = b0 * v0->uv + b1 * v1->uv + b2 * v2->uv;
         interaction->pos = hitPos;
+        interaction->triangle = object / 3;
         interaction->front_face = glm::dot(ray.d, interaction->normal) < 0;
         ray.tMax = t;
 
+        //the footprint is only worked out for the closest hit, unless the normal map needs it now
+        interaction->uv_scale = triangle_uv_scales[object / 3];
+
         if (normal_map) {
+            interaction->SetFootprint(ray.cone_width + ray.cone_spread * t * glm::length(ray.d), ray.d);
+            //decoded when the normal map was set, filtering only shortens it a little
             glm::vec4 normal = normal_map->Evaluate(*interaction);
-            normal = glm::normalize(normal * 2.0f - 1.0f);
             interaction->normal += normal_map_strength * (normal.x * v0->tangent + normal.y * v0->bitangent);
             interaction->normal = glm::normalize(interaction->normal);
         }
@@ -399,7 +485,8 @@ namespace MyPBRT {
     {
         std::vector < std::vector<std::pair<Integrator::RasterPixel, Integrator::RasterPixel>>> transformed_edges;
 
-        for (int i = 0; i < indices.size(); i += 3) {
+        const uint32_t* indices = geometry.indices;
+        for (int i = 0; i < geometry.index_count; i += 3) {
             const Vertex& v1 = transformed_vertices[indices[i]],
                 &v2 = transformed_vertices[indices[i + 1]],
                 &v3 = transformed_vertices[indices[i + 2]];
@@ -441,6 +528,12 @@ namespace MyPBRT {
             rotation[i] = node["rotation"][i].asFloat();
         for (int i = 0; i < 3; i++)
             scale[i] = node["scale"][i].asFloat();
+        if (node["normal map"].isNull() == false)
+            normal_map = Texture::ParseTexture(node["normal map"]);
+        if (normal_map)
+            normal_map->DecodeNormals();
+        if (node["normal map strength"].isNull() == false)
+            normal_map_strength = node["normal map strength"].asFloat();
     }
 
     Json::Value Mesh::Serialize() const
@@ -461,15 +554,23 @@ namespace MyPBRT {
 
     void Mesh::ApplyTransformation()
     {
-        triangle_areas.reserve(ceil(indices.size()/3));
-        transformed_vertices.resize(vertices.size());
+        MYPBRT_TRACE_SCOPE("Mesh::ApplyTransformation");
+        const uint32_t* indices = geometry.indices;
+        //recomputed from scratch every time the mesh moves
+        triangle_areas.clear();
+        triangle_areas.reserve(geometry.index_count / 3);
+        triangle_uv_scales.clear();
+        area_table = AliasTable();
+        triangle_uv_scales.reserve(geometry.index_count / 3);
+        total_area = 0;
+        transformed_vertices.resize(geometry.vertex_count);
         glm::vec3 min(std::numeric_limits<float>::max()), max(std::numeric_limits<float>::lowest());
         
         //vertex transforms
-        for (int i = 0; i < vertices.size(); i++) {
-            transformed_vertices[i].position = position + rotation * (vertices[i].position * scale);
-            transformed_vertices[i].normal = glm::normalize(rotation * vertices[i].normal);
-            transformed_vertices[i].uv = vertices[i].uv;
+        for (int i = 0; i < geometry.vertex_count; i++) {
+            transformed_vertices[i].position = position + rotation * (geometry.positions[i] * scale);
+            transformed_vertices[i].normal = glm::normalize(rotation * geometry.normals[i]);
+            transformed_vertices[i].uv = geometry.uvs[i];
 
             for(int j = 0; j < 3; j++){
                 if (transformed_vertices[i].position[j] < min[j]) min[j] = transformed_vertices[i].position[j];
@@ -480,7 +581,8 @@ namespace MyPBRT {
         //triangle transforms
         bounds = Bounds(min, max);
         std::vector<Bounds> all_bounds;
-        for (int i = 0; i < indices.size(); i += 3) {
+        all_bounds.reserve(geometry.index_count / 3);
+        for (int i = 0; i < geometry.index_count; i += 3) {
             glm::vec3 p0 = transformed_vertices[indices[i]].position,
                 p1 = transformed_vertices[indices[i + 1]].position,
                 p2 = transformed_vertices[indices[i + 2]].position;
@@ -518,6 +620,9 @@ namespace MyPBRT {
             float area = TriangleArea(p0, p1, p2);
             total_area += area;
             triangle_areas.push_back(area);
+
+            float uv_area = 0.5f * fabs(dUV1.x * dUV2.y - dUV1.y * dUV2.x);
+            triangle_uv_scales.push_back(area > 0 ? sqrtf(uv_area / area) : 0.0f);
         }
 
         accel.Build(all_bounds);
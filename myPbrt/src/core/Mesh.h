@@ -4,6 +4,7 @@
 #include "BaseTypes.h"
 #include "BVHAccelerator.h"
 #include "Integrator.h"
+#include "Sampler.h"
 #include <functional>
 
 #include <json/json.h>
@@ -23,11 +24,31 @@ namespace MyPBRT {
 			void DeSerialize(const Json::Value& node);
 		};
 
+		//object space data the mesh is built from, the arrays point either into a mapped meshes.bin or into buffers kept by storage
+		struct Geometry {
+			const glm::vec3* positions = nullptr;
+			const glm::vec3* normals = nullptr;
+			const glm::vec2* uvs = nullptr;
+			const uint32_t* indices = nullptr;
+			uint32_t vertex_count = 0;
+			uint32_t index_count = 0;
+			//keeps whatever the arrays point into alive
+			std::shared_ptr<const void> storage;
+
+			//takes ownership of the arrays
+			static Geometry Own(std::vector<glm::vec3>&& positions, std::vector<glm::vec3>&& normals, std::vector<glm::vec2>&& uvs, std::vector<uint32_t>&& indices);
+		};
+
 	public:
 		static std::shared_ptr<Mesh> ParseMesh(const Json::Value& node);
 
 	public:
 		Mesh(const std::vector<Vertex>& _vertices, const std::vector<uint32_t>& _indices);
+		Mesh(const Geometry& _geometry);
+
+		//replaces the object space data and rebuilds everything derived from it
+		void SetGeometry(const Geometry& _geometry);
+		const Geometry& GetGeometry() const { return geometry; }
 
 		void ApplyTransformation();
 
@@ -35,6 +56,11 @@ namespace MyPBRT {
 		bool Intersect(const Ray& ray, SurfaceInteraction* intersection, bool testAlphaTexture = false) const;
 		bool hasIntersections(const Ray& ray, bool testAlphaTexture = false) const;
 		float Area() const;
+		//picks triangles by their area, needed by SamplePoint and only built for meshes that emit light
+		void BuildAreaTable();
+		//uniformly distributed point on the surface, the pdf over area is 1 / Area()
+		SurfaceInteraction SamplePoint() const;
+		glm::vec3 TriangleNormal(int triangle) const;
 		//true if scene should update
 		bool CreateIMGUI();
 		void DrawLines(const glm::vec2& resolution, const Camera& camera, const glm::vec3& color, IntegratorSetPixelFunctionPtr set_function) const;
@@ -52,15 +78,10 @@ namespace MyPBRT {
 		void DeSerialize(const Json::Value& node) override;
 		Json::Value Serialize() const override;
 		std::string GetType() const { return "Mesh"; };
-		const std::vector<Vertex>& GetVertices() const { return vertices; };
-		std::vector<Vertex>& GetVertices() { return vertices; };
-		const std::vector<uint32_t>& GetIndices() const { return indices; };
-		std::vector<uint32_t>& GetIndices() { return indices; };
 
 	private:
-		std::vector<Vertex> vertices;
+		Geometry geometry;
 		std::vector<Vertex> transformed_vertices;
-		std::vector<uint32_t> indices;
 		std::vector<std::pair<int, int>> edges;
 		glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
 		glm::vec3 position = glm::vec3(0.0f);
@@ -74,7 +95,10 @@ namespace MyPBRT {
 		std::function<bool(const Ray&, SurfaceInteraction*, int)> triangle_intersection_func = [this](const Ray& ray, SurfaceInteraction* interaction, int object)->bool { return IntersectTriangle(ray, interaction, object); };
 		
 		std::vector<float> triangle_areas;
-		float total_area;
+		//sqrt of uv area over world area of every triangle, turns a width on the surface into one in uv space
+		std::vector<float> triangle_uv_scales;
+		float total_area = 0;
+		AliasTable area_table;
 		glm::vec3 triangle_center;
 
 		Bounds bounds;
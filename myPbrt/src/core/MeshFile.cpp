@@ -0,0 +1,177 @@
+#include "MeshFile.h"
+
+#include "MappedFile.h"
+#include "Trace.h"
+
+#include <fstream>
+#include <cstring>
+#include <filesystem>
+
+namespace MyPBRT {
+
+	namespace MeshFile {
+
+		static uint64_t Align(uint64_t offset)
+		{
+			return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+		}
+
+		//true if count elements of size bytes at offset lie inside the file and are aligned
+		static bool InFile(uint64_t offset, uint64_t count, uint64_t size, uint64_t file_size)
+		{
+			return offset % ALIGNMENT == 0 && offset <= file_size && count <= (file_size - offset) / size;
+		}
+
+		bool Write(const std::string& path, const std::vector<std::shared_ptr<Mesh>>& meshes)
+		{
+			MYPBRT_TRACE_SCOPE("MeshFile::Write");
+			Header header = {};
+			memcpy(header.magic, MAGIC, sizeof(MAGIC));
+			header.version = VERSION;
+			header.mesh_count = (uint32_t)meshes.size();
+			header.table_offset = sizeof(Header);
+
+			std::vector<Entry> table(meshes.size());
+			uint64_t offset = Align(header.table_offset + table.size() * sizeof(Entry));
+			for (int i = 0; i < meshes.size(); i++) {
+				const Mesh::Geometry& geometry = meshes[i]->GetGeometry();
+				Entry& entry = table[i];
+				entry.vertex_count = geometry.vertex_count;
+				entry.index_count = geometry.index_count;
+				entry.positions = offset;
+				offset = Align(offset + geometry.vertex_count * sizeof(glm::vec3));
+				entry.normals = offset;
+				offset = Align(offset + geometry.vertex_count * sizeof(glm::vec3));
+				entry.uvs = offset;
+				offset = Align(offset + geometry.vertex_count * sizeof(glm::vec2));
+				entry.indices = offset;
+				offset = Align(offset + geometry.index_count * sizeof(uint32_t));
+			}
+			header.file_size = offset;
+
+			//meshes may point into the file that is being replaced, so it is written next to it and swapped in at the end
+			std::string temporary_path = path + ".tmp";
+			std::ofstream file(temporary_path, std::ios::binary | std::ios::out | std::ios::trunc);
+			if (!file.is_open()) {
+				return false;
+			}
+
+			const char padding[ALIGNMENT] = {};
+			uint64_t written = 0;
+			auto write = [&](uint64_t at, const void* data, uint64_t size) {
+				file.write(padding, at - written);
+				file.write((const char*)data, size);
+				written = at + size;
+			};
+
+			write(0, &header, sizeof(header));
+			write(header.table_offset, table.data(), table.size() * sizeof(Entry));
+			for (int i = 0; i < meshes.size(); i++) {
+				const Mesh::Geometry& geometry = meshes[i]->GetGeometry();
+				write(table[i].positions, geometry.positions, geometry.vertex_count * sizeof(glm::vec3));
+				write(table[i].normals, geometry.normals, geometry.vertex_count * sizeof(glm::vec3));
+				write(table[i].uvs, geometry.uvs, geometry.vertex_count * sizeof(glm::vec2));
+				write(table[i].indices, geometry.indices, geometry.index_count * sizeof(uint32_t));
+			}
+			file.write(padding, header.file_size - written);
+			file.close();
+			if (!file.good()) {
+				std::filesystem::remove(temporary_path);
+				return false;
+			}
+
+			std::error_code error;
+			std::filesystem::rename(temporary_path, path, error);
+			return !error;
+		}
+
+		//the old format, counts followed by interleaved vertices and indices for every mesh
+		static std::vector<Mesh::Geometry> ReadUnversioned(const std::string& path)
+		{
+			std::vector<Mesh::Geometry> ret;
+			std::ifstream file(path, std::ios::binary | std::ios::in);
+
+			uint32_t numMeshes = 0;
+			file.read((char*)(&numMeshes), sizeof(uint32_t));
+
+			for (int i = 0; i < numMeshes && file.good(); i++) {
+				uint32_t numVertices = 0;
+				uint32_t numIndices = 0;
+				file.read((char*)(&numVertices), sizeof(uint32_t));
+				file.read((char*)(&numIndices), sizeof(uint32_t));
+
+				std::vector<glm::vec3> positions(numVertices), normals(numVertices);
+				std::vector<glm::vec2> uvs(numVertices);
+				for (int v = 0; v < numVertices; v++) {
+					file.read((char*)(&positions[v]), sizeof(glm::vec3));
+					file.read((char*)(&normals[v]), sizeof(glm::vec3));
+					file.read((char*)(&uvs[v]), sizeof(glm::vec2));
+				}
+
+				std::vector<uint32_t> indices(numIndices);
+				file.read((char*)indices.data(), numIndices * sizeof(uint32_t));
+
+				if (!file.good()) {
+					std::cerr << path << " ends in the middle of mesh " << i << "\n";
+					return {};
+				}
+				ret.push_back(Mesh::Geometry::Own(std::move(positions), std::move(normals), std::move(uvs), std::move(indices)));
+			}
+
+			return ret;
+		}
+
+		std::vector<Mesh::Geometry> Read(const std::string& path)
+		{
+			MYPBRT_TRACE_SCOPE("MeshFile::Read");
+			std::shared_ptr<MappedFile> mapping = MappedFile::Open(path);
+			if (!mapping) {
+				std::cerr << "couldn't open " << path << "\n";
+				return {};
+			}
+
+			if (mapping->Size() < sizeof(Header) || memcmp(mapping->Data(), MAGIC, sizeof(MAGIC)) != 0) {
+				return ReadUnversioned(path);
+			}
+
+			const Header& header = *(const Header*)mapping->Data();
+			uint64_t file_size = mapping->Size();
+			if (header.version != VERSION) {
+				std::cerr << path << " has version " << header.version << ", only " << VERSION << " is supported\n";
+				return {};
+			}
+			if (header.file_size > file_size || header.table_offset % alignof(Entry) != 0 || header.table_offset > file_size
+				|| header.mesh_count > (file_size - header.table_offset) / sizeof(Entry)) {
+				std::cerr << path << " is truncated\n";
+				return {};
+			}
+
+			const Entry* table = (const Entry*)(mapping->Data() + header.table_offset);
+			std::vector<Mesh::Geometry> ret(header.mesh_count);
+			for (int i = 0; i < header.mesh_count; i++) {
+				const Entry& entry = table[i];
+				if (entry.index_count % 3 != 0
+					|| !InFile(entry.positions, entry.vertex_count, sizeof(glm::vec3), file_size)
+					|| !InFile(entry.normals, entry.vertex_count, sizeof(glm::vec3), file_size)
+					|| !InFile(entry.uvs, entry.vertex_count, sizeof(glm::vec2), file_size)
+					|| !InFile(entry.indices, entry.index_count, sizeof(uint32_t), file_size)) {
+					std::cerr << path << " has a broken entry for mesh " << i << "\n";
+					return {};
+				}
+
+				Mesh::Geometry& geometry = ret[i];
+				geometry.positions = (const glm::vec3*)(mapping->Data() + entry.positions);
+				geometry.normals = (const glm::vec3*)(mapping->Data() + entry.normals);
+				geometry.uvs = (const glm::vec2*)(mapping->Data() + entry.uvs);
+				geometry.indices = (const uint32_t*)(mapping->Data() + entry.indices);
+				geometry.vertex_count = entry.vertex_count;
+				geometry.index_count = entry.index_count;
+				geometry.storage = mapping;
+			}
+
+			return ret;
+		}
+
+	}
+
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "core.h"
+#include "Mesh.h"
+
+//meshes.bin of a saved scene
+//
+//a 64 byte header, a table with an entry per mesh and then the arrays of every mesh
+//each array starts on a 64 byte boundary so the meshes can point straight into the mapped file
+//everything is little endian, a mesh is referenced from data.json by its index in the table
+//
+//files written before the header existed start with the mesh count and are still read, by copying
+
+namespace MyPBRT {
+
+	namespace MeshFile {
+
+		constexpr char MAGIC[8] = { 'M', 'Y', 'P', 'B', 'R', 'T', 'M', 'B' };
+		constexpr uint32_t VERSION = 1;
+		constexpr uint64_t ALIGNMENT = 64;
+
+		struct Header {
+			char magic[8];
+			uint32_t version;
+			uint32_t mesh_count;
+			uint64_t table_offset;
+			uint64_t file_size;
+			uint8_t reserved[32];
+		};
+
+		//offsets are from the start of the file
+		struct Entry {
+			uint32_t vertex_count;
+			uint32_t index_count;
+			uint64_t positions;
+			uint64_t normals;
+			uint64_t uvs;
+			uint64_t indices;
+		};
+
+		static_assert(sizeof(Header) == ALIGNMENT, "header has to keep the table aligned");
+		static_assert(sizeof(Entry) == 40, "entries are written as they are in memory");
+
+		bool Write(const std::string& path, const std::vector<std::shared_ptr<Mesh>>& meshes);
+		//geometry of every mesh in the file, empty if the file is missing or broken
+		std::vector<Mesh::Geometry> Read(const std::string& path);
+
+	}
+
+}
@@ -0,0 +1,288 @@
+#include "ObjFile.h"
+
+#include "MappedFile.h"
+#include "Trace.h"
+
+#include <charconv>
+#include <execution>
+#include <numeric>
+#include <thread>
+#include <atomic>
+#include <cstring>
+
+namespace MyPBRT {
+
+	namespace ObjFile {
+
+		//chunks are at least this big so small files don't pay for threads
+		constexpr size_t MIN_CHUNK_SIZE = 1 << 20;
+		constexpr uint32_t MISSING = std::numeric_limits<uint32_t>::max();
+
+		struct Chunk {
+			const char* begin;
+			const char* end;
+			//what the chunk contains, turned into where its data starts by the prefix sums
+			size_t positions = 0;
+			size_t uvs = 0;
+			size_t normals = 0;
+			size_t faces = 0;
+			size_t corners = 0;
+			size_t triangles = 0;
+		};
+
+		//a corner references the file wide arrays, MISSING if the face doesn't specify it
+		struct Corner {
+			uint32_t position;
+			uint32_t uv;
+			uint32_t normal;
+		};
+
+		static bool IsSpace(char c)
+		{
+			return c == ' ' || c == '\t' || c == '\r';
+		}
+
+		static const char* SkipSpaces(const char* at, const char* end)
+		{
+			while (at < end && IsSpace(*at)) at++;
+			return at;
+		}
+
+		static const char* LineEnd(const char* at, const char* end)
+		{
+			const char* newline = (const char*)memchr(at, '\n', end - at);
+			return newline ? newline : end;
+		}
+
+		enum class LineType { Other, Position, UV, Normal, Face };
+
+		//also moves at past the keyword
+		static LineType ReadLineType(const char*& at, const char* end)
+		{
+			at = SkipSpaces(at, end);
+			if (end - at < 2) return LineType::Other;
+			if (at[0] == 'f' && IsSpace(at[1])) {
+				at += 2;
+				return LineType::Face;
+			}
+			if (at[0] != 'v') return LineType::Other;
+			if (IsSpace(at[1])) {
+				at += 2;
+				return LineType::Position;
+			}
+			if (end - at < 3 || !IsSpace(at[2])) return LineType::Other;
+			if (at[1] == 't') {
+				at += 3;
+				return LineType::UV;
+			}
+			if (at[1] == 'n') {
+				at += 3;
+				return LineType::Normal;
+			}
+			return LineType::Other;
+		}
+
+		static int CountTokens(const char* at, const char* end)
+		{
+			int count = 0;
+			while (true) {
+				at = SkipSpaces(at, end);
+				if (at >= end) return count;
+				count++;
+				while (at < end && !IsSpace(*at)) at++;
+			}
+		}
+
+		template <int N>
+		static void ReadFloats(const char* at, const char* end, float* out)
+		{
+			for (int i = 0; i < N; i++) {
+				at = SkipSpaces(at, end);
+				float value = 0;
+				auto result = std::from_chars(at, end, value);
+				out[i] = value;
+				at = result.ptr;
+			}
+		}
+
+		//resolves a 1 based reference or a negative one relative to the count parsed before the line
+		static uint32_t ReadReference(const char*& at, const char* end, size_t count, size_t total, bool& valid)
+		{
+			int64_t value = 0;
+			auto result = std::from_chars(at, end, value);
+			if (result.ptr == at) {
+				return MISSING;
+			}
+			at = result.ptr;
+			int64_t index = value > 0 ? value - 1 : (int64_t)count + value;
+			if (value == 0 || index < 0 || index >= (int64_t)total) {
+				valid = false;
+				return MISSING;
+			}
+			return (uint32_t)index;
+		}
+
+		//v, v/vt, v//vn or v/vt/vn
+		static Corner ReadCorner(const char*& at, const char* end, const Chunk& counts, const Chunk& total, bool& valid)
+		{
+			Corner corner = { MISSING, MISSING, MISSING };
+			corner.position = ReadReference(at, end, counts.positions, total.positions, valid);
+			if (corner.position == MISSING) valid = false;
+			if (at < end && *at == '/') {
+				at++;
+				corner.uv = ReadReference(at, end, counts.uvs, total.uvs, valid);
+				if (at < end && *at == '/') {
+					at++;
+					corner.normal = ReadReference(at, end, counts.normals, total.normals, valid);
+				}
+			}
+			//skips whatever is left of a malformed corner
+			while (at < end && !IsSpace(*at)) at++;
+			return corner;
+		}
+
+		static std::vector<Chunk> SplitIntoChunks(const char* data, size_t size)
+		{
+			size_t count = std::max<size_t>(1, std::min<size_t>(size / MIN_CHUNK_SIZE, 4 * std::max(1u, std::thread::hardware_concurrency())));
+			std::vector<Chunk> chunks;
+			const char* begin = data;
+			const char* end = data + size;
+			for (size_t i = 1; i <= count && begin < end; i++) {
+				const char* split = i == count ? end : std::max(begin, data + size * i / count);
+				const char* newline = LineEnd(split, end);
+				split = newline < end ? newline + 1 : end;
+				chunks.push_back({ begin, split });
+				begin = split;
+			}
+			return chunks;
+		}
+
+		bool Load(const std::string& path, Mesh::Geometry& geometry)
+		{
+			MYPBRT_TRACE_SCOPE("ObjFile::Load");
+			std::shared_ptr<MappedFile> file = MappedFile::Open(path);
+			if (!file) {
+				std::cerr << "couldn't open " << path << "\n";
+				return false;
+			}
+
+			std::vector<Chunk> chunks = SplitIntoChunks((const char*)file->Data(), file->Size());
+
+			//first pass only counts, so every chunk knows where to put its data in the second one
+			std::for_each(std::execution::par, chunks.begin(), chunks.end(), [](Chunk& chunk) {
+				for (const char* line = chunk.begin; line < chunk.end;) {
+					const char* end = LineEnd(line, chunk.end);
+					switch (ReadLineType(line, end)) {
+					case LineType::Position: chunk.positions++; break;
+					case LineType::UV: chunk.uvs++; break;
+					case LineType::Normal: chunk.normals++; break;
+					case LineType::Face: {
+						int corners = CountTokens(line, end);
+						chunk.faces++;
+						chunk.corners += corners;
+						chunk.triangles += std::max(0, corners - 2);
+						break;
+					}
+					default: break;
+					}
+					line = end < chunk.end ? end + 1 : chunk.end;
+				}
+				});
+
+			Chunk total = { nullptr, nullptr };
+			for (Chunk& chunk : chunks) {
+				Chunk counts = chunk;
+				chunk.positions = total.positions;
+				chunk.uvs = total.uvs;
+				chunk.normals = total.normals;
+				chunk.faces = total.faces;
+				chunk.corners = total.corners;
+				chunk.triangles = total.triangles;
+				total.positions += counts.positions;
+				total.uvs += counts.uvs;
+				total.normals += counts.normals;
+				total.faces += counts.faces;
+				total.corners += counts.corners;
+				total.triangles += counts.triangles;
+			}
+			if (total.corners >= MISSING) {
+				std::cerr << path << " has too many vertices\n";
+				return false;
+			}
+
+			std::vector<glm::vec3> file_positions(total.positions), file_normals(total.normals);
+			std::vector<glm::vec2> file_uvs(total.uvs);
+			std::vector<Corner> corners(total.corners);
+			//first corner of every face, the last entry closes the last face
+			std::vector<uint32_t> faces(total.faces + 1, (uint32_t)total.corners);
+			std::vector<uint32_t> indices(total.triangles * 3);
+			std::atomic<bool> valid = true;
+
+			std::for_each(std::execution::par, chunks.begin(), chunks.end(), [&](const Chunk& start) {
+				Chunk chunk = start;
+				bool chunk_valid = true;
+				for (const char* line = chunk.begin; line < chunk.end;) {
+					const char* end = LineEnd(line, chunk.end);
+					switch (ReadLineType(line, end)) {
+					case LineType::Position: ReadFloats<3>(line, end, glm::value_ptr(file_positions[chunk.positions++])); break;
+					case LineType::UV: ReadFloats<2>(line, end, glm::value_ptr(file_uvs[chunk.uvs++])); break;
+					case LineType::Normal: ReadFloats<3>(line, end, glm::value_ptr(file_normals[chunk.normals++])); break;
+					case LineType::Face: {
+						uint32_t first = (uint32_t)chunk.corners;
+						faces[chunk.faces++] = first;
+						while ((line = SkipSpaces(line, end)) < end) {
+							corners[chunk.corners++] = ReadCorner(line, end, chunk, total, chunk_valid);
+						}
+						for (uint32_t i = first + 2; i < chunk.corners; i++) {
+							indices[chunk.triangles * 3 + 0] = first;
+							indices[chunk.triangles * 3 + 1] = i - 1;
+							indices[chunk.triangles * 3 + 2] = i;
+							chunk.triangles++;
+						}
+						break;
+					}
+					default: break;
+					}
+					line = end < chunk.end ? end + 1 : chunk.end;
+				}
+				if (!chunk_valid) valid = false;
+				});
+
+			if (!valid) {
+				std::cerr << path << " references vertex data that doesn't exist\n";
+				return false;
+			}
+
+			//every corner becomes a vertex, faces without normals get a flat one
+			std::vector<glm::vec3> positions(total.corners), normals(total.corners);
+			std::vector<glm::vec2> uvs(total.corners);
+			std::vector<uint32_t> face_indices(total.faces);
+			std::iota(face_indices.begin(), face_indices.end(), 0);
+			std::for_each(std::execution::par, face_indices.begin(), face_indices.end(), [&](uint32_t face) {
+				uint32_t first = faces[face], last = faces[face + 1];
+				bool has_normals = true;
+				for (uint32_t i = first; i < last; i++) {
+					const Corner& corner = corners[i];
+					positions[i] = file_positions[corner.position];
+					uvs[i] = corner.uv == MISSING ? glm::vec2(0) : file_uvs[corner.uv];
+					if (corner.normal == MISSING) has_normals = false;
+					else normals[i] = file_normals[corner.normal];
+				}
+				if (!has_normals) {
+					glm::vec3 normal(0);
+					if (last - first >= 3) {
+						normal = glm::cross(positions[first + 1] - positions[first], positions[first + 2] - positions[first]);
+					}
+					for (uint32_t i = first; i < last; i++) {
+						normals[i] = normal;
+					}
+				}
+				});
+
+			geometry = Mesh::Geometry::Own(std::move(positions), std::move(normals), std::move(uvs), std::move(indices));
+			return true;
+		}
+
+	}
+
+}
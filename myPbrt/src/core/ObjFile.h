@@ -0,0 +1,21 @@
+#pragma once
+
+#include "core.h"
+#include "Mesh.h"
+
+//wavefront obj importer
+//
+//the file is mapped and split into chunks at line boundaries that are parsed in parallel
+//only v, vt, vn and f are read, every face corner becomes its own vertex and polygons are split into fans
+//corners without a normal get the normal of their face, counter clockwise faces point towards the viewer
+
+namespace MyPBRT {
+
+	namespace ObjFile {
+
+		//false with an error in std::cerr if the file can't be read or references data it doesn't have
+		bool Load(const std::string& path, Mesh::Geometry& geometry);
+
+	}
+
+}
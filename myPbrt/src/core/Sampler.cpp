@@ -1 +1,56 @@
 #include "Sampler.h"
+
+#include <algorithm>
+
+namespace MyPBRT {
+
+	AliasTable::AliasTable(const std::vector<float>& weights)
+	{
+		double sum = 0;
+		for (float weight : weights) {
+			sum += std::max(weight, 0.0f);
+		}
+		if (!(sum > 0)) {
+			return;
+		}
+
+		size_t count = weights.size();
+		bins.resize(count);
+		//scaled so the average bin is 1, bins under it are topped up by the ones over it
+		std::vector<double> scaled(count);
+		std::vector<uint32_t> under, over;
+		for (size_t i = 0; i < count; i++) {
+			bins[i].pmf = (float)(std::max(weights[i], 0.0f) / sum);
+			scaled[i] = std::max(weights[i], 0.0f) / sum * count;
+			(scaled[i] < 1.0 ? under : over).push_back((uint32_t)i);
+		}
+
+		while (!under.empty() && !over.empty()) {
+			uint32_t small = under.back(), large = over.back();
+			under.pop_back();
+			bins[small].keep = (float)scaled[small];
+			bins[small].alias = large;
+			scaled[large] -= 1.0 - scaled[small];
+			if (scaled[large] < 1.0) {
+				over.pop_back();
+				under.push_back(large);
+			}
+		}
+		//whatever is left is 1 up to rounding
+		for (uint32_t i : under) bins[i] = { 1.0f, i, bins[i].pmf };
+		for (uint32_t i : over) bins[i] = { 1.0f, i, bins[i].pmf };
+	}
+
+	uint32_t AliasTable::Sample(float u, float* pmf) const
+	{
+		float scaled = u * bins.size();
+		uint32_t index = std::min((uint32_t)scaled, (uint32_t)bins.size() - 1);
+		//the fraction left over decides between the bin and its alias
+		if (scaled - index >= bins[index].keep) {
+			index = bins[index].alias;
+		}
+		if (pmf) *pmf = bins[index].pmf;
+		return index;
+	}
+
+}
@@ -1,10 +1,35 @@
 #pragma once
 
+#include "core.h"
+
 namespace MyPBRT {
 
 	class Sampler
 	{
 	};
 
-}
+	//picks index i with probability weights[i] / sum of weights in constant time
+	//every bin holds the chance of keeping its own index and which index to take otherwise
+	class AliasTable
+	{
+	public:
+		AliasTable() {}
+		AliasTable(const std::vector<float>& weights);
+
+		//u in [0, 1), pmf is the probability of the picked index
+		uint32_t Sample(float u, float* pmf = nullptr) const;
+		float PMF(uint32_t index) const { return bins[index].pmf; }
+		size_t Size() const { return bins.size(); }
+		//false if there were no weights or they were all 0
+		bool Valid() const { return !bins.empty(); }
 
+	private:
+		struct Bin {
+			float keep;
+			uint32_t alias;
+			float pmf;
+		};
+		std::vector<Bin> bins;
+	};
+
+}
@@ -5,17 +5,17 @@
 #include "Texture.h"
 #include "Material.h"
 #include "Light.h"
+#include "Stats.h"
+#include "Trace.h"
+#include "MeshFile.h"
+#include "ObjFile.h"
 
 #include <filesystem>
 
-#include <vendor/obj_loader/OBJ_Loader.h>
-
 #include <json/json.h>
 
 namespace MyPBRT {
 
-	static objl::Loader modelLoader;
-
 	bool Scene::Intersect(const Ray& ray, SurfaceInteraction* interaction) const
 	{
 		bool hit = false;
@@ -50,14 +50,70 @@ namespace MyPBRT {
 
 	bool Scene::hasIntersectionsAccel(const Ray& ray) const
 	{
+		MYPBRT_COUNT(ShadowRays);
 		return BVHAccel.HasIntersections(0, objects, ray, meshes);
 	}
 
 	void Scene::Preprocess()
 	{
+		MYPBRT_TRACE_SCOPE("Scene::Preprocess");
 		for (auto& mesh : meshes) {
 			mesh->Preprocess();
 		}
+
+		material_table.resize(materials.size());
+		for (int i = 0; i < materials.size(); i++) {
+			material_table[i] = materials[i]->Compile();
+		}
+
+		//collected every time since materials and objects can change between frames
+		emissive_objects.clear();
+		emissive_pmfs.assign(objects.size(), 0.0f);
+		std::vector<float> powers;
+		for (int i = 0; i < objects.size(); i++) {
+			if (objects[i].material < 0 || objects[i].material >= materials.size()) continue;
+			const EmissiveMaterial* emissive = dynamic_cast<const EmissiveMaterial*>(materials[objects[i].material].get());
+			if (!emissive) continue;
+			Mesh& mesh = *meshes[objects[i].shape];
+			float power = mesh.Area() * glm::dot(emissive->emission, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+			if (!(power > 0)) continue;
+			mesh.BuildAreaTable();
+			emissive_objects.push_back(i);
+			powers.push_back(power);
+		}
+		emissive_table = AliasTable(powers);
+		for (int i = 0; i < emissive_objects.size(); i++) {
+			emissive_pmfs[emissive_objects[i]] = emissive_table.PMF(i);
+		}
+	}
+
+	bool Scene::SampleEmissive(const glm::vec3& from, SurfaceInteraction* point, float* pdf) const
+	{
+		if (!emissive_table.Valid()) return false;
+		float pmf;
+		int object = emissive_objects[emissive_table.Sample(random_double(), &pmf)];
+		const Mesh& mesh = ObjectToMesh(object);
+		*point = mesh.SamplePoint();
+		point->primitive = object;
+
+		//area is turned into solid angle by distance squared over the cosine at the light, both sides emit
+		glm::vec3 d = point->pos - from;
+		float distance_squared = glm::length2(d);
+		float cos_theta = std::abs(glm::dot(point->normal, d)) / sqrt(distance_squared);
+		if (!(cos_theta > 0)) return false;
+		*pdf = pmf / mesh.Area() * distance_squared / cos_theta;
+		return true;
+	}
+
+	float Scene::EmissivePDF(const glm::vec3& from, const SurfaceInteraction& hit) const
+	{
+		if (hit.primitive < 0 || hit.primitive >= emissive_pmfs.size() || emissive_pmfs[hit.primitive] == 0) return 0.0f;
+		const Mesh& mesh = ObjectToMesh(hit.primitive);
+		glm::vec3 d = hit.pos - from;
+		float distance_squared = glm::length2(d);
+		float cos_theta = std::abs(glm::dot(mesh.TriangleNormal(hit.triangle), d)) / sqrt(distance_squared);
+		if (!(cos_theta > 0)) return 0.0f;
+		return emissive_pmfs[hit.primitive] / mesh.Area() * distance_squared / cos_theta;
 	}
 
 	void Scene::DrawLines(const glm::vec2& resolution, const Camera& camera, const glm::vec3& color, IntegratorSetPixelFunctionPtr set_function) const
@@ -70,19 +126,10 @@ namespace MyPBRT {
 
 	void Scene::LoadOBJ(const std::string& path)
 	{
-		if (modelLoader.LoadFile("models/" + path + ".obj")) {
-
-			std::vector<MyPBRT::Mesh::Vertex> trimeshvertices;
-
-			for (auto& vertex : modelLoader.LoadedVertices) {
-				glm::vec3 position(vertex.Position.X, vertex.Position.Y, vertex.Position.Z);
-				glm::vec3 normal(vertex.Normal.X, vertex.Normal.Y, vertex.Normal.Z);
-				glm::vec2 uv(vertex.TextureCoordinate.X, vertex.TextureCoordinate.Y);
-				trimeshvertices.push_back({ position, normal, uv });
-			}
-
-			std::vector<uint32_t> trimeshindices = modelLoader.LoadedIndices;
-			meshes.push_back(std::shared_ptr<Mesh>(new Mesh(trimeshvertices, trimeshindices)));
+		MYPBRT_TRACE_SCOPE("Scene::LoadOBJ");
+		Mesh::Geometry geometry;
+		if (ObjFile::Load("models/" + path + ".obj", geometry)) {
+			meshes.push_back(std::shared_ptr<Mesh>(new Mesh(geometry)));
 			objects.push_back(Object(meshes.size() - 1, 0));
 			Build();
 		}
@@ -99,6 +146,8 @@ namespace MyPBRT {
 
 	void Scene::Save(const std::string& foldername, Json::Value& root) const
 	{
+		MYPBRT_TRACE_SCOPE("Scene::Save");
+		Texture::scene_folder = foldername;
 		for (const auto& light : lights) {
 			root["lights"].append(light->Serialize());
 		}
@@ -114,38 +163,17 @@ namespace MyPBRT {
 			root["objects"].append(val);
 		}
 
-		std::ofstream file(foldername + "/meshes.bin", std::ios::binary | std::ios::out);
-
-		uint32_t numMeshes = (uint32_t)(meshes.size());
-		file.write((const char*)&numMeshes, sizeof(numMeshes));
-
 		int i = 0;
 		for (const auto& mesh : meshes) {
 			Json::Value meshNode = mesh->Serialize();
 			meshNode["data"] = i;
 			root["meshes"].append(meshNode);
 			i++;
-
-			const std::vector<Mesh::Vertex>& vertices = mesh->GetVertices();
-			uint32_t numVertices = (uint32_t)(vertices.size());
-			file.write((const char*)&numVertices, sizeof(numVertices));
-			
-			const std::vector<uint32_t>& indices = mesh->GetIndices();
-			uint32_t numIndices = (uint32_t)(indices.size());
-			file.write((const char*)&numIndices, sizeof(numIndices));
-
-			for (const auto& vertex : vertices) {
-				file.write((const char*)(&vertex.position), sizeof(vertex.position));
-				file.write((const char*)(&vertex.normal), sizeof(vertex.normal));
-				file.write((const char*)(&vertex.uv), sizeof(vertex.uv));
-			}
-			
-			for (const auto& index : indices) {
-				file.write((const char*)(&index), sizeof(index));
-			}
 		}
 
-		file.close();
+		if (!MeshFile::Write(foldername + "/meshes.bin", meshes)) {
+			std::cerr << "couldn't write " << foldername << "/meshes.bin\n";
+		}
 	}
 
 	void Scene::Load(const std::string& foldername, const Json::Value& node)
@@ -156,6 +184,8 @@ namespace MyPBRT {
 
 	void Scene::MergeLoad(const std::string& foldername, const Json::Value& node)
 	{
+		MYPBRT_TRACE_SCOPE("Scene::MergeLoad");
+		Texture::scene_folder = foldername;
 		int PrevNumMeshes = meshes.size();
 		int PrevNumMaterials = materials.size();
 
@@ -175,47 +205,15 @@ namespace MyPBRT {
 			o.material= PrevNumMaterials + node["material"].asInt();
 		}
 
-		std::vector<std::vector<Mesh::Vertex>> vertices_per_mesh;
-		std::vector<std::vector<uint32_t>> indices_per_mesh;
-		
-		std::ifstream file(foldername + "/meshes.bin", std::ios::binary | std::ios::in);
-		
-		uint32_t numMeshes;
-		file.read((char*)(&numMeshes), sizeof(uint32_t));
-		
-		for (int i = 0; i < numMeshes; i++) {
-			uint32_t numVertices;
-			uint32_t numIndices;
-			file.read((char*)(&numVertices), sizeof(uint32_t));
-			file.read((char*)(&numIndices), sizeof(uint32_t));
-
-			std::vector<Mesh::Vertex> vertices;
-			vertices.resize(numVertices);
-			for (int v = 0; v < numVertices; v++) {
-				file.read((char*)(&vertices[v].position), sizeof(glm::vec3));
-				file.read((char*)(&vertices[v].normal), sizeof(glm::vec3));
-				file.read((char*)(&vertices[v].uv), sizeof(glm::vec2));
-			}
-
-			std::vector<uint32_t> indices;
-			indices.resize(numIndices);
-			for (int j = 0; j < numIndices; j++) {
-				uint32_t data;
-				file.read((char*)(&data), sizeof(uint32_t));
-				indices.push_back(data);
-			}
-
-			vertices_per_mesh.push_back(vertices);
-			indices_per_mesh.push_back(indices);
-		}
-
-		file.close();
+		//the meshes point into the mapped file, it stays mapped for as long as one of them uses it
+		std::vector<Mesh::Geometry> geometries = MeshFile::Read(foldername + "/meshes.bin");
 		
 		for (const auto& mesh : node["meshes"]) {
 			meshes.push_back(Mesh::ParseMesh(mesh));
-			meshes[meshes.size() - 1]->GetVertices() = vertices_per_mesh[mesh["data"].asInt()];
-			meshes[meshes.size() - 1]->GetIndices() = indices_per_mesh[mesh["data"].asInt()];
-			meshes[meshes.size() - 1]->ApplyTransformation();
+			int data = mesh["data"].asInt();
+			if (data >= 0 && data < geometries.size()) {
+				meshes[meshes.size() - 1]->SetGeometry(geometries[data]);
+			}
 		}
 
 		Build();
@@ -223,13 +221,16 @@ namespace MyPBRT {
 
 	void Scene::Build()
 	{
+		MYPBRT_TRACE_SCOPE("Scene::Build");
 		std::vector<Bounds> all_bounds;
 		for (auto& object : objects) {
 			const Mesh& mesh = *meshes[object.shape];
 			all_bounds.push_back(mesh.GetBounds());
 		}
 		BVHAccel.Build(all_bounds);
+#ifdef _DEBUG
 		BVHAccel.PrintNode(0);
+#endif
 	}
 
 	void Scene::AddObject(const Object& object)
@@ -246,6 +247,7 @@ namespace MyPBRT {
 
 	void Scene::RecalculateObject(int id)
 	{
+		MYPBRT_TRACE_SCOPE("Scene::RecalculateObject");
 		BVHAccel.RecalculateObject(objects, id, meshes);
 	}
 
@@ -3,6 +3,7 @@
 #include "core.h"
 #include "Mesh.h"
 #include "BVHAccelerator.h"
+#include "Material.h"
 
 #include <json/json.h>
 
@@ -15,12 +16,23 @@ struct Scene
 	std::vector<std::shared_ptr<Mesh>> meshes;
 	std::vector<Object> objects;
 	BVHAccelerator BVHAccel;
+	//materials compiled by Preprocess, same order as materials
+	std::vector<MaterialRecord> material_table;
+	//objects with an emissive material, collected by Preprocess and picked in proportion to the light they give off
+	std::vector<int> emissive_objects;
+	AliasTable emissive_table;
+	//chance of every object to be picked by SampleEmissive, 0 for the ones that don't emit
+	std::vector<float> emissive_pmfs;
 
 	bool Intersect(const Ray& ray, SurfaceInteraction* interaction) const;
 	bool IntersectAccel(const Ray& ray, SurfaceInteraction* interaction) const;
 	bool hasIntersections(const Ray& ray) const;
 	bool hasIntersectionsAccel(const Ray& ray) const;
 	void Preprocess();
+	//point on an emissive object to light from with, pdf is per solid angle, false if there is nothing to sample
+	bool SampleEmissive(const glm::vec3& from, SurfaceInteraction* point, float* pdf) const;
+	//pdf SampleEmissive gives the point a ray from from hit
+	float EmissivePDF(const glm::vec3& from, const SurfaceInteraction& hit) const;
 
 	void DrawLines(const glm::vec2& resolution, const Camera& camera, const glm::vec3& color, IntegratorSetPixelFunctionPtr set_function) const;
 	
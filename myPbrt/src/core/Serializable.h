@@ -9,7 +9,7 @@ namespace MyPBRT{
 	public:
 		virtual void DeSerialize(const Json::Value& node) = 0;
 		virtual Json::Value Serialize() const = 0;
-		virtual std::string GetType() const { return ""; };
+		std::string GetType() const { return ""; };
 	};
 
 }
@@ -0,0 +1,48 @@
+#include "Stats.h"
+
+#ifdef MYPBRT_STATS
+
+#include <mutex>
+#include <algorithm>
+
+namespace MyPBRT {
+
+	namespace Stats {
+
+		static std::mutex registry_mutex;
+		static std::vector<ThreadCounters*> registry;
+		//what threads that exited had counted
+		static CounterValues retired = {};
+
+		ThreadCounters::ThreadCounters()
+		{
+			std::lock_guard<std::mutex> lock(registry_mutex);
+			registry.push_back(this);
+		}
+
+		ThreadCounters::~ThreadCounters()
+		{
+			std::lock_guard<std::mutex> lock(registry_mutex);
+			for (int i = 0; i < COUNTER_COUNT; i++) {
+				retired[i] += values[i].load(std::memory_order_relaxed);
+			}
+			registry.erase(std::remove(registry.begin(), registry.end(), this), registry.end());
+		}
+
+		CounterValues Collect()
+		{
+			std::lock_guard<std::mutex> lock(registry_mutex);
+			CounterValues totals = retired;
+			for (ThreadCounters* counters : registry) {
+				for (int i = 0; i < COUNTER_COUNT; i++) {
+					totals[i] += counters->values[i].load(std::memory_order_relaxed);
+				}
+			}
+			return totals;
+		}
+
+	}
+
+}
+
+#endif
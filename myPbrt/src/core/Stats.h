@@ -0,0 +1,68 @@
+#pragma once
+
+#include "core.h"
+
+#include <atomic>
+
+//per thread counters of what rendering does, only compiled in with MYPBRT_STATS
+//without it every MYPBRT_COUNT expands to nothing
+
+namespace MyPBRT {
+
+	enum class Counter {
+		CameraRays = 0,
+		ShadowRays,
+		BVHNodes,
+		TriangleTests,
+		MaterialEvaluations,
+		TextureFetches,
+		TextureTileLoads,
+		Count
+	};
+
+	constexpr int COUNTER_COUNT = (int)Counter::Count;
+	using CounterValues = std::array<uint64_t, COUNTER_COUNT>;
+
+	inline const char* CounterName(Counter counter) {
+		constexpr const char* names[COUNTER_COUNT] = { "camera rays", "shadow rays", "bvh nodes", "triangle tests", "material evaluations", "texture fetches", "texture tile loads" };
+		return names[(int)counter];
+	}
+
+#ifdef MYPBRT_STATS
+
+	namespace Stats {
+
+		//only the owning thread writes, relaxed loads and stores compile to plain adds
+		//the atomics are there so reading the totals from another thread is not a data race
+		struct alignas(64) ThreadCounters {
+			std::atomic<uint64_t> values[COUNTER_COUNT] = {};
+
+			ThreadCounters();
+			~ThreadCounters();
+		};
+
+		inline ThreadCounters& Local() {
+			thread_local ThreadCounters counters;
+			return counters;
+		}
+
+		inline void Add(Counter counter, uint64_t amount = 1) {
+			std::atomic<uint64_t>& value = Local().values[(int)counter];
+			value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+		}
+
+		//totals of every thread since the start, including threads that already exited
+		CounterValues Collect();
+	}
+
+#define MYPBRT_COUNT(counter) ::MyPBRT::Stats::Add(::MyPBRT::Counter::counter)
+#define MYPBRT_COUNT_N(counter, amount) ::MyPBRT::Stats::Add(::MyPBRT::Counter::counter, amount)
+
+#else
+
+#define MYPBRT_COUNT(counter) ((void)0)
+#define MYPBRT_COUNT_N(counter, amount) ((void)0)
+
+#endif
+
+}
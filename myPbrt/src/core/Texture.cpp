@@ -1,9 +1,22 @@
 #include "Texture.h"
 #include "imgui.h"
 
+#include "Stats.h"
+#include "Trace.h"
+#include "MappedFile.h"
+
 #include <imgui/imgui_stdlib.h>
+#include <glm/gtc/packing.hpp>
 #include <stb_image/stb_image.h>
+#ifndef MYPBRT_NO_GL
 #include <glad/glad.h>
+#endif
+
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+#include <execution>
+#include <numeric>
 
 namespace MyPBRT {
 
@@ -13,29 +26,169 @@ namespace MyPBRT {
 	float Texture::checkerboard_scale = 10.0f;
 	std::string Texture::image_path = "";
 	float Texture::constant_value_tex_value = 1.0f;
+	std::string Texture::scene_folder = ".";
+	const char* ImageTexture::format_names[4] = { "linear", "srgb", "half", "normal" };
+
+	//raw pixels of images that have no source file, a header followed by width * height * channels bytes
+	struct TextureBlobHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t width;
+		uint32_t height;
+		uint32_t channels;
+	};
+	constexpr char TEXTURE_BLOB_MAGIC[8] = { 'M', 'Y', 'P', 'B', 'R', 'T', 'T', 'X' };
+
+	//64 bit fnv-1a, stable across runs and platforms
+	static uint64_t HashBytes(const uint8_t* data, size_t size, uint64_t hash = 14695981039346656037ull)
+	{
+		for (size_t i = 0; i < size; i++) {
+			hash = (hash ^ data[i]) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	static std::string HashToString(uint64_t hash)
+	{
+		char text[17];
+		snprintf(text, sizeof(text), "%016llx", (unsigned long long)hash);
+		return text;
+	}
+
+	static bool DecodeImage(const uint8_t* bytes, size_t size, std::vector<uint8_t>& data, uint32_t& width, uint32_t& height, uint8_t& channels)
+	{
+		int w, h, c;
+		unsigned char* img = stbi_load_from_memory(bytes, (int)size, &w, &h, &c, 0);
+		if (img == NULL) {
+			return false;
+		}
+		data.assign(img, img + (size_t)w * h * c);
+		stbi_image_free(img);
+		width = w;
+		height = h;
+		channels = c;
+		return true;
+	}
 
+	static bool DecodeImage(const uint8_t* bytes, size_t size, std::vector<float>& data, uint32_t& width, uint32_t& height, uint8_t& channels)
+	{
+		int w, h, c;
+		float* img = stbi_loadf_from_memory(bytes, (int)size, &w, &h, &c, 0);
+		if (img == NULL) {
+			return false;
+		}
+		data.assign(img, img + (size_t)w * h * c);
+		stbi_image_free(img);
+		width = w;
+		height = h;
+		channels = c;
+		return true;
+	}
+
+	static std::array<float, 256> SRGBTable()
+	{
+		std::array<float, 256> table;
+		for (int i = 0; i < 256; i++) {
+			float c = i / 255.0f;
+			table[i] = c <= 0.04045f ? c / 12.92f : pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+		return table;
+	}
+	static const std::array<float, 256> SRGB_TO_LINEAR = SRGBTable();
+
+	//averages 4 texels for the next mip level
+	static uint32_t AverageBytes(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+	{
+		uint32_t texel = 0;
+		for (int shift = 0; shift < 32; shift += 8) {
+			uint32_t sum = ((a >> shift) & 0xff) + ((b >> shift) & 0xff) + ((c >> shift) & 0xff) + ((d >> shift) & 0xff);
+			texel |= ((sum + 2) / 4) << shift;
+		}
+		return texel;
+	}
+
+	static uint64_t AverageHalfs(uint64_t a, uint64_t b, uint64_t c, uint64_t d)
+	{
+		return glm::packHalf4x16((glm::unpackHalf4x16(a) + glm::unpackHalf4x16(b) + glm::unpackHalf4x16(c) + glm::unpackHalf4x16(d)) * 0.25f);
+	}
+
+	//writes bytes to path unless a file is already there, the name contains the hash so it has the same contents
+	static bool WriteOnce(const std::filesystem::path& path, const void* header, size_t header_size, const void* data, size_t size)
+	{
+		if (std::filesystem::exists(path)) {
+			return true;
+		}
+		std::filesystem::create_directories(path.parent_path());
+		std::filesystem::path temporary_path = path.string() + ".tmp";
+		std::ofstream file(temporary_path, std::ios::binary);
+		file.write((const char*)header, header_size);
+		file.write((const char*)data, size);
+		file.close();
+		std::error_code error;
+		if (!file.good()) {
+			std::filesystem::remove(temporary_path, error);
+			return false;
+		}
+		std::filesystem::rename(temporary_path, path, error);
+		return !error;
+	}
+
+	template <>
+	std::string ConstantTexture<float>::GetType() {
+		return "ConstantFloat";
+	}
+	template <>
+	std::string ConstantTexture<glm::vec2>::GetType() {
+		return "ConstantVec2";
+	}
+	template <>
+	std::string ConstantTexture<glm::vec3>::GetType() {
+		return "ConstantVec3";
+	}
+
+	template <>
 	glm::vec4 ConstantTexture<float>::Evaluate(const SurfaceInteraction&) const
 	{
 		return glm::vec4(value);
 	}
+	template <>
 	glm::vec4 ConstantTexture<glm::vec2>::Evaluate(const SurfaceInteraction&) const
 	{
 		return glm::vec4(value.x, value.y, 0, 0);
 	}
+	template <>
 	glm::vec4 ConstantTexture<glm::vec3>::Evaluate(const SurfaceInteraction&) const
 	{
 		return glm::vec4(value.x, value.y, value.z, 0);
 	}
+	TextureRef::TextureRef(const Texture* _texture, const glm::vec4& _value)
+		: value(_value)
+	{
+		if (!_texture) return;
+		if (dynamic_cast<const ConstantTexture<float>*>(_texture) || dynamic_cast<const ConstantTexture<glm::vec2>*>(_texture) || dynamic_cast<const ConstantTexture<glm::vec3>*>(_texture)) {
+			value = _texture->Evaluate(SurfaceInteraction());
+		}
+		else if (const ImageTexture* image_texture = dynamic_cast<const ImageTexture*>(_texture)) {
+			image = image_texture;
+		}
+		else {
+			texture = _texture;
+		}
+	}
+
+	template <>
 	void ConstantTexture<float>::CreateIMGUI()
 	{
 		ImGui::DragFloat("color", &value, 0.01, 0, std::numeric_limits<float>::max());
 	}
 
+	template <>
 	void ConstantTexture<float>::DeSerialize(const Json::Value& node)
 	{
 		value = node["value"].asFloat();
 	}
 
+	template <>
 	Json::Value ConstantTexture<float>::Serialize() const
 	{
 		Json::Value ret = Texture::Serialize();
@@ -44,12 +197,14 @@ namespace MyPBRT {
 		return ret;
 	}
 	
+	template <>
 	void ConstantTexture<glm::vec2>::DeSerialize(const Json::Value& node)
 	{
 		for(int i = 0; i < 2; i++)
 			value[i] = node["value"][i].asFloat();
 	}
 
+	template <>
 	Json::Value ConstantTexture<glm::vec2>::Serialize() const
 	{
 		Json::Value ret = Texture::Serialize();
@@ -59,12 +214,14 @@ namespace MyPBRT {
 		return ret;
 	}
 	
+	template <>
 	void ConstantTexture<glm::vec3>::DeSerialize(const Json::Value& node)
 	{
 		for (int i = 0; i < 3; i++)
 			value[i] = node["value"][i].asFloat();
 	}
 
+	template <>
 	Json::Value ConstantTexture<glm::vec3>::Serialize() const
 	{
 		Json::Value ret = Texture::Serialize();
@@ -74,11 +231,13 @@ namespace MyPBRT {
 		return ret;
 	}
 
+	template <>
 	void ConstantTexture<glm::vec2>::CreateIMGUI()
 	{
 		ImGui::DragFloat2("color", glm::value_ptr(value), 0.01, 0, std::numeric_limits<float>::max());
 	}
 
+	template <>
 	void ConstantTexture<glm::vec3>::CreateIMGUI()
 	{
 		ImGui::ColorEdit3("color", glm::value_ptr(value));
@@ -127,8 +286,292 @@ namespace MyPBRT {
 	}
 
 	ImageTexture::ImageTexture(std::vector<uint8_t> _data, uint32_t _width, uint32_t _height, uint8_t _channels, double _inverseMult)
-		: data(_data), width(_width), height(_height), inverseMult(_inverseMult), channels(_channels)
+		: width(_width), height(_height), inverseMult(_inverseMult), channels(_channels)
+	{
+		MYPBRT_TRACE_SCOPE("ImageTexture::ImageTexture");
+		BuildLevels(_data);
+		UpdateScale();
+		CreateImage(_data, width, height);
+	}
+
+	ImageTexture::Level::Level(uint32_t _width, uint32_t _height)
+		: width(_width), height(_height), tiles_x((_width + TILE_SIZE - 1) / TILE_SIZE)
+	{
+	}
+
+	bool ImageTexture::Load(const uint8_t* bytes, size_t size, std::string hash)
+	{
+		MYPBRT_TRACE_SCOPE("ImageTexture::Load");
+		//images with values above 1 are kept as halfs, the texture cache only stores rgba8
+		if (stbi_is_hdr_from_memory(bytes, (int)size)) {
+			std::vector<float> data;
+			if (!DecodeImage(bytes, size, data, width, height, channels)) {
+				return false;
+			}
+			format = Format::Half;
+			BuildLevels(data);
+			UpdateScale();
+			CreateImage(Pixels(), width, height);
+			return true;
+		}
+
+		format = Format::Linear;
+		std::string cache_path;
+		if (TextureCache::memory_budget > 0) {
+			if (hash.empty()) {
+				hash = HashToString(HashBytes(bytes, size));
+			}
+			cache_path = TextureCache::folder + "/" + hash + ".tiles";
+			if (OpenCached(cache_path)) {
+				return true;
+			}
+		}
+
+		std::vector<uint8_t> data;
+		const TextureBlobHeader* header = (const TextureBlobHeader*)bytes;
+		if (size >= sizeof(TextureBlobHeader) && memcmp(header->magic, TEXTURE_BLOB_MAGIC, sizeof(TEXTURE_BLOB_MAGIC)) == 0) {
+			size_t pixels_size = (size_t)header->width * header->height * header->channels;
+			if (header->version != 1 || size - sizeof(TextureBlobHeader) < pixels_size) {
+				return false;
+			}
+			width = header->width;
+			height = header->height;
+			channels = header->channels;
+			data.assign(bytes + sizeof(TextureBlobHeader), bytes + sizeof(TextureBlobHeader) + pixels_size);
+		}
+		else if (!DecodeImage(bytes, size, data, width, height, channels)) {
+			return false;
+		}
+		BuildLevels(data);
+
+		//converted once while the whole image is in memory anyway, after that only the tiles in use are
+		if (!cache_path.empty()) {
+			std::vector<glm::uvec2> sizes;
+			for (const Level& level : levels) {
+				sizes.push_back({ level.width, level.height });
+			}
+			bool written = TextureCache::Image::Write(cache_path, channels, sizes, [&](uint32_t level, uint32_t tile_x, uint32_t tile_y, uint32_t* texels) {
+				const Level& l = levels[level];
+				uint32_t x0 = tile_x * TextureCache::TILE_SIZE, y0 = tile_y * TextureCache::TILE_SIZE;
+				for (uint32_t y = y0; y < std::min(y0 + TextureCache::TILE_SIZE, l.height); y++) {
+					for (uint32_t x = x0; x < std::min(x0 + TextureCache::TILE_SIZE, l.width); x++) {
+						texels[(y - y0) * TextureCache::TILE_SIZE + x - x0] = l.texels[l.Index(x, y)];
+					}
+				}
+				});
+			if (written && OpenCached(cache_path)) {
+				return true;
+			}
+			std::cerr << "couldn't write texture cache file " << cache_path << "\n";
+		}
+		UpdateScale();
+		CreateImage(data, width, height);
+		return true;
+	}
+
+	bool ImageTexture::OpenCached(const std::string& path)
+	{
+		std::shared_ptr<TextureCache::Image> image = TextureCache::Image::Open(path);
+		if (!image) {
+			return false;
+		}
+		cached = image;
+		channels = image->Channels();
+		width = image->Levels()[0].width;
+		height = image->Levels()[0].height;
+		levels.clear();
+		for (const TextureCache::Level& level : image->Levels()) {
+			levels.emplace_back(level.width, level.height);
+		}
+		UpdateScale();
+
+#ifndef MYPBRT_NO_GL
+		//the editor only shows a small preview, the first level that isn't bigger than it is enough
+		int preview = 0;
+		while (preview + 1 < (int)levels.size() && std::max(levels[preview].width, levels[preview].height) > 256) {
+			preview++;
+		}
+		CreateImage(Pixels(preview), levels[preview].width, levels[preview].height);
+#endif
+		return true;
+	}
+
+	void ImageTexture::BuildLevels(const std::vector<uint8_t>& pixels)
+	{
+		MYPBRT_TRACE_SCOPE("ImageTexture::BuildLevels");
+		cached = nullptr;
+		levels.clear();
+		levels.emplace_back(width, height);
+		levels[0].texels.resize(levels[0].TexelCount());
+
+		std::vector<uint32_t> rows(height);
+		std::iota(rows.begin(), rows.end(), 0);
+		std::for_each(std::execution::par, rows.begin(), rows.end(), [&](uint32_t y) {
+			Level& level = levels[0];
+			for (uint32_t x = 0; x < width; x++) {
+				const uint8_t* pixel = &pixels[((size_t)y * width + x) * channels];
+				uint32_t texel = channels < 4 ? 0xff000000u : 0;
+				for (int c = 0; c < channels; c++) {
+					texel |= (uint32_t)pixel[c] << (8 * c);
+				}
+				level.texels[level.Index(x, y)] = texel;
+			}
+			});
+		BuildMips();
+	}
+
+	void ImageTexture::BuildLevels(const std::vector<float>& pixels)
+	{
+		MYPBRT_TRACE_SCOPE("ImageTexture::BuildLevels");
+		cached = nullptr;
+		levels.clear();
+		levels.emplace_back(width, height);
+		levels[0].texels.resize(levels[0].TexelCount() * 2);
+
+		std::vector<uint32_t> rows(height);
+		std::iota(rows.begin(), rows.end(), 0);
+		std::for_each(std::execution::par, rows.begin(), rows.end(), [&](uint32_t y) {
+			Level& level = levels[0];
+			for (uint32_t x = 0; x < width; x++) {
+				const float* pixel = &pixels[((size_t)y * width + x) * channels];
+				glm::vec4 texel(0, 0, 0, 1);
+				for (int c = 0; c < channels; c++) {
+					texel[c] = pixel[c];
+				}
+				uint64_t packed = glm::packHalf4x16(texel);
+				memcpy(&level.texels[level.Index(x, y) * 2], &packed, sizeof(packed));
+			}
+			});
+		BuildMips();
+	}
+
+	void ImageTexture::BuildMips()
 	{
+		levels.erase(levels.begin() + 1, levels.end());
+		const uint32_t stride = Stride();
+		std::vector<uint32_t> rows(levels[0].height);
+		std::iota(rows.begin(), rows.end(), 0);
+		while (levels.back().width > 1 || levels.back().height > 1) {
+			const Level& previous = levels.back();
+			Level level(std::max(1u, previous.width / 2), std::max(1u, previous.height / 2));
+			level.texels.resize(level.TexelCount() * stride);
+
+			//box filter, odd sizes drop their last row or column
+			std::for_each(std::execution::par, rows.begin(), rows.begin() + level.height, [&](uint32_t y) {
+				uint32_t y0 = std::min(2 * y, previous.height - 1), y1 = std::min(2 * y + 1, previous.height - 1);
+				for (uint32_t x = 0; x < level.width; x++) {
+					uint32_t x0 = std::min(2 * x, previous.width - 1), x1 = std::min(2 * x + 1, previous.width - 1);
+					const uint32_t* a = &previous.texels[previous.Index(x0, y0) * stride];
+					const uint32_t* b = &previous.texels[previous.Index(x1, y0) * stride];
+					const uint32_t* c = &previous.texels[previous.Index(x0, y1) * stride];
+					const uint32_t* d = &previous.texels[previous.Index(x1, y1) * stride];
+					uint32_t* texel = &level.texels[level.Index(x, y) * stride];
+					if (format == Format::Half) {
+						uint64_t half[4];
+						memcpy(&half[0], a, sizeof(uint64_t));
+						memcpy(&half[1], b, sizeof(uint64_t));
+						memcpy(&half[2], c, sizeof(uint64_t));
+						memcpy(&half[3], d, sizeof(uint64_t));
+						uint64_t average = AverageHalfs(half[0], half[1], half[2], half[3]);
+						memcpy(texel, &average, sizeof(uint64_t));
+					}
+					else {
+						*texel = AverageBytes(*a, *b, *c, *d);
+					}
+				}
+				});
+			levels.push_back(std::move(level));
+		}
+	}
+
+	void ImageTexture::UpdateScale()
+	{
+		switch (format) {
+		case Format::Linear:
+			scale = glm::vec4((float)inverseMult);
+			offset = glm::vec4(0);
+			break;
+		case Format::SRGB:
+			scale = glm::vec4(1, 1, 1, (float)inverseMult);
+			offset = glm::vec4(0);
+			break;
+		case Format::Half:
+			scale = glm::vec4(1);
+			offset = glm::vec4(0);
+			break;
+		case Format::Normal:
+			scale = glm::vec4(2.0f * (float)inverseMult);
+			offset = glm::vec4(-1);
+			break;
+		}
+		//images without alpha are opaque
+		if (channels < 4) {
+			scale.w = 0;
+			offset.w = 1;
+		}
+	}
+
+	void ImageTexture::SetFormat(Format _format)
+	{
+		if (format == _format || format == Format::Half || _format == Format::Half) {
+			return;
+		}
+		format = _format;
+		UpdateScale();
+	}
+
+	void ImageTexture::DecodeNormals()
+	{
+		if (format == Format::Normal || format == Format::Half) {
+			return;
+		}
+		SetFormat(Format::Normal);
+		if (cached) {
+			return;
+		}
+
+		//normalized once here instead of on every hit, the bytes still map 0 to 255 onto -1 to 1
+		std::vector<uint32_t>& texels = levels[0].texels;
+		std::for_each(std::execution::par, texels.begin(), texels.end(), [](uint32_t& texel) {
+			glm::vec3 normal = glm::vec3(texel & 0xff, (texel >> 8) & 0xff, (texel >> 16) & 0xff) * (2.0f / 255.0f) - 1.0f;
+			float length = glm::length(normal);
+			normal = length > 0 ? normal / length : glm::vec3(0, 0, 1);
+			glm::uvec3 bytes = glm::uvec3(glm::round((normal * 0.5f + 0.5f) * 255.0f));
+			texel = (texel & 0xff000000u) | bytes.x | (bytes.y << 8) | (bytes.z << 16);
+			});
+		BuildMips();
+	}
+
+	std::vector<uint8_t> ImageTexture::Pixels(int level) const
+	{
+		const Level& l = levels[level];
+		std::vector<uint8_t> pixels((size_t)l.width * l.height * channels);
+		for (uint32_t y = 0; y < l.height; y++) {
+			for (uint32_t x = 0; x < l.width; x++) {
+				uint8_t* pixel = &pixels[((size_t)y * l.width + x) * channels];
+				//halfs are clamped, only the editor preview and images without a file end up here
+				if (format == Format::Half) {
+					glm::vec4 texel = Decode(&l.texels[l.Index(x, y) * 2]);
+					for (int c = 0; c < channels; c++) {
+						pixel[c] = (uint8_t)(glm::clamp(texel[c], 0.0f, 1.0f) * 255.0f + 0.5f);
+					}
+					continue;
+				}
+				uint32_t texel = Texel(level, x, y);
+				for (int c = 0; c < channels; c++) {
+					pixel[c] = (texel >> (8 * c)) & 0xff;
+				}
+			}
+		}
+		return pixels;
+	}
+
+	void ImageTexture::CreateImage(const std::vector<uint8_t>& pixels, uint32_t image_width, uint32_t image_height)
+	{
+#ifndef MYPBRT_NO_GL
+		if (image) {
+			glDeleteTextures(1, &image);
+		}
 		glGenTextures(1, &image);
 		glBindTexture(GL_TEXTURE_2D, image);
 
@@ -155,54 +598,208 @@ namespace MyPBRT {
 			break;
 		}
 
-		glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, data_format, GL_UNSIGNED_BYTE, data.data());
+		glTexImage2D(GL_TEXTURE_2D, 0, internal_format, image_width, image_height, 0, data_format, GL_UNSIGNED_BYTE, pixels.data());
 		glBindTexture(GL_TEXTURE_2D, 0);
+#endif
 	}
 
-	glm::vec4 ImageTexture::Evaluate(const SurfaceInteraction& interaction) const
+	uint32_t ImageTexture::Texel(int level, uint32_t x, uint32_t y) const
 	{
-		float u = glm::clamp(interaction.uv.x, 0.0f, 1.0f);
-		float v = 1.0 - glm::clamp(interaction.uv.y, 0.0f, 1.0f);
-		int i = u * width;
-		int j = v * height;
+		return cached ? cached->Texel(level, x, y) : levels[level].texels[levels[level].Index(x, y)];
+	}
+
+	glm::vec4 ImageTexture::Decode(const uint32_t* texel) const
+	{
+		switch (format) {
+		case Format::SRGB:
+			return glm::vec4(SRGB_TO_LINEAR[texel[0] & 0xff], SRGB_TO_LINEAR[(texel[0] >> 8) & 0xff], SRGB_TO_LINEAR[(texel[0] >> 16) & 0xff], texel[0] >> 24);
+		case Format::Half: {
+			uint64_t packed;
+			memcpy(&packed, texel, sizeof(packed));
+			return glm::unpackHalf4x16(packed);
+		}
+		default:
+			return glm::vec4(texel[0] & 0xff, (texel[0] >> 8) & 0xff, (texel[0] >> 16) & 0xff, texel[0] >> 24);
+		}
+	}
 
-		if (i >= width)  i = width - 1;
-		if (j >= height) j = height - 1;
+	glm::vec4 ImageTexture::Bilinear(int level, const glm::vec2& uv) const
+	{
+		const Level& l = levels[level];
+		//texel centers sit at half coordinates, lookups past the edges clamp
+		float x = uv.x * l.width - 0.5f;
+		float y = uv.y * l.height - 0.5f;
+		float fx = floor(x), fy = floor(y);
+		float tx = x - fx, ty = y - fy;
+		uint32_t x0 = glm::clamp((int)fx, 0, (int)l.width - 1), x1 = glm::clamp((int)fx + 1, 0, (int)l.width - 1);
+		uint32_t y0 = glm::clamp((int)fy, 0, (int)l.height - 1), y1 = glm::clamp((int)fy + 1, 0, (int)l.height - 1);
+
+		if (cached) {
+			uint32_t t00 = cached->Texel(level, x0, y0), t10 = cached->Texel(level, x1, y0);
+			uint32_t t01 = cached->Texel(level, x0, y1), t11 = cached->Texel(level, x1, y1);
+			glm::vec4 top = glm::mix(Decode(&t00), Decode(&t10), tx);
+			glm::vec4 bottom = glm::mix(Decode(&t01), Decode(&t11), tx);
+			return glm::mix(top, bottom, ty);
+		}
+
+		//the neighbours are a step away inside the tile or the first texel of the next one
+		const uint32_t tile_end = TILE_SIZE - 1;
+		const uint32_t stride = Stride();
+		const uint32_t* texels = l.texels.data() + l.Index(x0, y0) * stride;
+		size_t dx = x0 == x1 ? 0 : (x0 & tile_end) != tile_end ? 1 : TILE_SIZE * TILE_SIZE - tile_end;
+		size_t dy = y0 == y1 ? 0 : (y0 & tile_end) != tile_end ? TILE_SIZE : (size_t)l.tiles_x * TILE_SIZE * TILE_SIZE - tile_end * TILE_SIZE;
+		dx *= stride;
+		dy *= stride;
 
-		int pixel = (j * width + i) * channels;
-		glm::vec4 val(0, 0, 0, 1);
-		for (int c = 0; c < channels; c++) {
-			val[c] = data[pixel + c] * inverseMult;
+		glm::vec4 top = glm::mix(Decode(texels), Decode(texels + dx), tx);
+		glm::vec4 bottom = glm::mix(Decode(texels + dy), Decode(texels + dx + dy), tx);
+		return glm::mix(top, bottom, ty);
+	}
+
+	glm::vec4 ImageTexture::Evaluate(const SurfaceInteraction& interaction) const
+	{
+		MYPBRT_COUNT(TextureFetches);
+		glm::vec2 uv(glm::clamp(interaction.uv.x, 0.0f, 1.0f), 1.0f - glm::clamp(interaction.uv.y, 0.0f, 1.0f));
+
+		//how many level 0 texels the footprint covers picks the level, blending the two closest ones
+		float texels = interaction.uv_footprint * sqrt((float)width * (float)height);
+		float lod = texels > 1.0f ? log2(texels) : 0.0f;
+		int last = (int)levels.size() - 1;
+		int level = std::min((int)lod, last);
+
+		glm::vec4 val = Bilinear(level, uv);
+		if (level < last && lod > level) {
+			val = glm::mix(val, Bilinear(level + 1, uv), lod - level);
 		}
-		return glm::vec4(val);
+		return val * scale + offset;
 	}
+
 	ImageTexture::~ImageTexture()
 	{
+#ifndef MYPBRT_NO_GL
 		glDeleteTextures(1, &image);
+#endif
 	}
 	void ImageTexture::CreateIMGUI()
 	{
 		ImGui::Image((void*)(intptr_t)image, ImVec2(200, 200));
+		if (format == Format::Linear || format == Format::SRGB) {
+			bool srgb = format == Format::SRGB;
+			if (ImGui::Checkbox("sRGB", &srgb)) {
+				SetFormat(srgb ? Format::SRGB : Format::Linear);
+			}
+		}
+		else {
+			ImGui::Text("%s", format_names[(int)format]);
+		}
 	}
 
 	void ImageTexture::DeSerialize(const Json::Value& node)
 	{
-		data = { 0xff };
-		width = 1;
-		height = 1;
-		channels = 3;
-		//TODO
+		MYPBRT_TRACE_SCOPE("ImageTexture::DeSerialize");
+		source = node["source"].asString();
+		bool loaded = false;
+
+		std::string file = node["file"].asString();
+		std::shared_ptr<MappedFile> mapping = file.empty() ? nullptr : MappedFile::Open(scene_folder + "/" + file);
+		if (mapping) {
+			std::string hash = HashToString(HashBytes(mapping->Data(), mapping->Size()));
+			if (hash != node["hash"].asString()) {
+				std::cerr << scene_folder << "/" << file << " was changed after it was saved\n";
+			}
+			loaded = Load(mapping->Data(), mapping->Size(), hash);
+		}
+		//scenes saved before textures had their own files
+		else if (node["data"].isArray()) {
+			width = node["width"].asUInt();
+			height = node["height"].asUInt();
+			channels = node["channels"].asUInt();
+			std::vector<uint8_t> data(node["data"].size());
+			for (int i = 0; i < data.size(); i++) {
+				data[i] = node["data"][i].asUInt();
+			}
+			if (!data.empty() && data.size() >= (size_t)width * height * channels) {
+				format = Format::Linear;
+				BuildLevels(data);
+				UpdateScale();
+				CreateImage(data, width, height);
+				loaded = true;
+			}
+		}
+
+		//the saved copy is gone, the original might still be around
+		if (!loaded && !source.empty()) {
+			std::shared_ptr<MappedFile> original = MappedFile::Open("textures/" + source);
+			if (original) {
+				loaded = Load(original->Data(), original->Size(), "");
+			}
+		}
+
+		if (!loaded) {
+			std::cerr << "couldn't load image texture " << (file.empty() ? source : file) << "\n";
+			std::vector<uint8_t> data = { 0xff, 0xff, 0xff };
+			width = 1;
+			height = 1;
+			channels = 3;
+			format = Format::Linear;
+			BuildLevels(data);
+			UpdateScale();
+			CreateImage(data, width, height);
+		}
+
+		//scenes saved before formats existed treat every image as linear
+		std::string saved_format = node["format"].asString();
+		if (saved_format == format_names[(int)Format::SRGB]) {
+			SetFormat(Format::SRGB);
+		}
+		else if (saved_format == format_names[(int)Format::Normal]) {
+			DecodeNormals();
+		}
 	}
 
 	Json::Value ImageTexture::Serialize() const
 	{
+		MYPBRT_TRACE_SCOPE("ImageTexture::Serialize");
 		Json::Value ret = Texture::Serialize();
+		ret["type"] = GetType();
 		ret["width"] = width;
 		ret["height"] = height;
 		ret["channels"] = channels;
 		ret["inverseMult"] = inverseMult;
-		for(const auto& d : data)
-			ret["data"].append(d);
+		ret["format"] = format_names[(int)format];
+
+		//the compressed original is much smaller than the pixels, it is copied when it still exists
+		std::shared_ptr<MappedFile> original = source.empty() ? nullptr : MappedFile::Open("textures/" + source);
+		std::string file;
+		std::string hash;
+		bool written = false;
+		if (original) {
+			hash = HashToString(HashBytes(original->Data(), original->Size()));
+			file = "textures/" + hash + std::filesystem::path(source).extension().string();
+			written = WriteOnce(scene_folder + "/" + file, nullptr, 0, original->Data(), original->Size());
+		}
+		else {
+			std::vector<uint8_t> data = Pixels();
+			TextureBlobHeader header = {};
+			memcpy(header.magic, TEXTURE_BLOB_MAGIC, sizeof(TEXTURE_BLOB_MAGIC));
+			header.version = 1;
+			header.width = width;
+			header.height = height;
+			header.channels = channels;
+			//the hash covers the whole file so loading checks it the same way for both kinds
+			hash = HashToString(HashBytes(data.data(), data.size(), HashBytes((const uint8_t*)&header, sizeof(header))));
+			file = "textures/" + hash + ".bin";
+			written = WriteOnce(scene_folder + "/" + file, &header, sizeof(header), data.data(), data.size());
+		}
+
+		if (!written) {
+			std::cerr << "couldn't write " << scene_folder << "/" << file << "\n";
+		}
+		ret["file"] = file;
+		ret["hash"] = hash;
+		if (!source.empty()) {
+			ret["source"] = source;
+		}
 		return ret;
 	}
 
@@ -253,6 +850,7 @@ namespace MyPBRT {
 		case TextureType::ConstantValue:
 			return std::shared_ptr<Texture>(new ConstantTexture<float>(constant_value_tex_value));
 		}
+		return nullptr;
 	}
 
 	std::shared_ptr<Texture> Texture::CreateTextureFromMenu(int* selected_option, const std::vector<TextureType>& types) {
@@ -277,20 +875,14 @@ namespace MyPBRT {
 
 
 	std::shared_ptr<Texture> Texture::LoadImage(const std::string& path) {
-		int width, height, channels;
-		std::string newPath = "textures/" + path;
-		unsigned char* img = stbi_load(newPath.c_str(), &width, &height, &channels, 0);
-		if (img == NULL) {
+		MYPBRT_TRACE_SCOPE("Texture::LoadImage");
+		std::shared_ptr<MappedFile> file = MappedFile::Open("textures/" + path);
+		std::shared_ptr<ImageTexture> ret = std::make_shared<ImageTexture>();
+		if (!file || !ret->Load(file->Data(), file->Size(), "")) {
 			return nullptr;
 		}
-
-		std::vector<uint8_t> data;
-		data.resize(width * height * channels);
-		for (int i = 0; i < width * height * channels; i++) {
-			data[i] = img[i];
-		}
-
-		return std::shared_ptr<Texture>(new ImageTexture(data, width, height, channels));
+		ret->source = path;
+		return ret;
 	}
 
 	std::shared_ptr<Texture> Texture::ParseTexture(const Json::Value& node)
@@ -316,24 +908,14 @@ namespace MyPBRT {
 		else if (type == "Image") {
 			ret = std::make_shared<ImageTexture>();
 		}
+		else {
+			return nullptr;
+		}
 
 		ret->DeSerialize(node);
 		return ret;
 	}
 
-	template <>
-	std::string ConstantTexture<float>::GetType() {
-		return "ConstantFloat";
-	}
-	template <>
-	std::string ConstantTexture<glm::vec2>::GetType() {
-		return "ConstantVec2";
-	}
-	template <>
-	std::string ConstantTexture<glm::vec3>::GetType() {
-		return "ConstantVec3";
-	}
-
 
 }
 
@@ -4,6 +4,7 @@
 #include "imgui.h"
 
 #include "Serializable.h"
+#include "TextureCache.h"
 
 namespace MyPBRT {
 
@@ -24,6 +25,8 @@ namespace MyPBRT {
 		static float checkerboard_scale;
 		static std::string image_path;
 		static float constant_value_tex_value;
+		//folder of the scene that is being saved or loaded, image textures keep their files in its textures folder
+		static std::string scene_folder;
 
 		static bool CreationMenuImGUI(int* selected_option, const std::vector<TextureType>& types);
 		static std::shared_ptr<Texture> CreateTexture();
@@ -39,6 +42,8 @@ namespace MyPBRT {
 		virtual glm::vec4 Evaluate(const SurfaceInteraction& interaction) const = 0;
 		virtual ~Texture() {}
 		virtual void CreateIMGUI() {};
+		//called on textures used as normal maps, afterwards Evaluate gives tangent space vectors in -1 to 1
+		virtual void DecodeNormals() {}
 	};
 
 	template<typename T>
@@ -93,6 +98,19 @@ namespace MyPBRT {
 	public:
 		static std::string GetType() { return "Image"; }
 
+		//how texels are stored, picked when the image is loaded
+		enum class Format {
+			//rgba8, every channel scales to 0 to 1
+			Linear = 0,
+			//rgba8, colors go through an srgb to linear table
+			SRGB = 1,
+			//rgba16f for images with values above 1, two words per texel
+			Half = 2,
+			//rgba8 unit vectors, every channel maps to -1 to 1
+			Normal = 3
+		};
+		static const char* format_names[4];
+
 	public:
 		ImageTexture() {};
 		ImageTexture(std::vector<uint8_t> _data, uint32_t _width, uint32_t _height, uint8_t _channels, double _inverseMult = 1.0f / 255.0f);
@@ -100,16 +118,87 @@ namespace MyPBRT {
 		glm::vec4 Evaluate(const SurfaceInteraction& interaction) const override;
 		void CreateIMGUI() override;
 
+		//images are stored next to the scene as a copy of their source file or as raw pixels
+		//the file is named after a hash of its contents so textures used more than once are only saved once
 		void DeSerialize(const Json::Value& node) override;
 		Json::Value Serialize() const override;
 
+		//decodes an image file or a raw pixel blob, with the texture cache on it is read from the cache file made of it instead
+		bool Load(const uint8_t* bytes, size_t size, std::string hash);
+		//switches between the rgba8 formats, half images stay half
+		void SetFormat(Format _format);
+		void DecodeNormals() override;
+
+	private:
+		bool OpenCached(const std::string& path);
+		//packs the pixels into level 0 and averages it down to a 1x1 level
+		void BuildLevels(const std::vector<uint8_t>& pixels);
+		void BuildLevels(const std::vector<float>& pixels);
+		void BuildMips();
+		void UpdateScale();
+		uint32_t Stride() const { return format == Format::Half ? 2 : 1; }
+		void CreateImage(const std::vector<uint8_t>& pixels, uint32_t image_width, uint32_t image_height);
+		uint32_t Texel(int level, uint32_t x, uint32_t y) const;
+		//channel values before scale and offset, one branch on the format instead of one per channel
+		glm::vec4 Decode(const uint32_t* texel) const;
+		glm::vec4 Bilinear(int level, const glm::vec2& uv) const;
+
 	public:
+		static constexpr uint32_t TILE_SHIFT = 3;
+		static constexpr uint32_t TILE_SIZE = 1 << TILE_SHIFT;
+
+		//rgba8 texels are packed into one word, halfs into two, missing channels are 0 and missing alpha is opaque
+		//they are stored in 8x8 tiles so neighbouring lookups in both directions share cache lines
+		struct Level {
+			uint32_t width;
+			uint32_t height;
+			uint32_t tiles_x;
+			std::vector<uint32_t> texels;
+
+			Level(uint32_t _width, uint32_t _height);
+			size_t TexelCount() const { return (size_t)tiles_x * ((height + TILE_SIZE - 1) / TILE_SIZE) * TILE_SIZE * TILE_SIZE; }
+			size_t Index(uint32_t x, uint32_t y) const {
+				size_t tile = (size_t)(y >> TILE_SHIFT) * tiles_x + (x >> TILE_SHIFT);
+				return (tile << (2 * TILE_SHIFT)) + ((y & (TILE_SIZE - 1)) << TILE_SHIFT) + (x & (TILE_SIZE - 1));
+			}
+		};
+
+		//a level in the layout the image was loaded in, channels interleaved row by row
+		std::vector<uint8_t> Pixels(int level = 0) const;
+
 		const double inverseMult = 1.0f / 255.0f;
+		Format format = Format::Linear;
+		//Evaluate returns the filtered texel * scale + offset
+		glm::vec4 scale = glm::vec4(1);
+		glm::vec4 offset = glm::vec4(0);
 		uint8_t channels = -1;
 		uint32_t width = -1;
 		uint32_t height = -1;
-		std::vector<uint8_t> data;
+		//mip pyramid, every level is half the size of the previous one
+		//levels have no texels of their own when the image is read through the texture cache
+		std::vector<Level> levels;
+		std::shared_ptr<TextureCache::Image> cached;
 		unsigned int image = 0;
+		//file the image was loaded from, relative to the textures folder, empty if it didn't come from one
+		std::string source;
+	};
+
+	//a texture the way the material table keeps it, constants are folded into their value
+	//and images are evaluated without going through the vtable
+	struct TextureRef {
+		glm::vec4 value = glm::vec4(0.0f);
+		const ImageTexture* image = nullptr;
+		//any other kind of texture
+		const Texture* texture = nullptr;
+
+		TextureRef() {}
+		//value is what a missing texture evaluates to
+		TextureRef(const Texture* _texture, const glm::vec4& _value);
+		glm::vec4 Evaluate(const SurfaceInteraction& interaction) const {
+			if (image) return image->ImageTexture::Evaluate(interaction);
+			if (texture) return texture->Evaluate(interaction);
+			return value;
+		}
 	};
 
 }
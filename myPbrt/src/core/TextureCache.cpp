@@ -0,0 +1,271 @@
+#include "TextureCache.h"
+#include "Stats.h"
+#include "Trace.h"
+
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace MyPBRT {
+
+	size_t TextureCache::memory_budget = 0;
+	std::string TextureCache::folder = (std::filesystem::temp_directory_path() / "myPbrt_texture_cache").string();
+
+	//a header, a table of levels and then the tiles of every level starting at a multiple of TILE_BYTES
+	struct CacheFileHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t channels;
+		uint32_t level_count;
+		uint32_t reserved[3];
+	};
+	constexpr char CACHE_FILE_MAGIC[8] = { 'M', 'Y', 'P', 'B', 'R', 'T', 'T', 'C' };
+	constexpr uint32_t CACHE_FILE_VERSION = 1;
+	static_assert(sizeof(CacheFileHeader) == 32 && sizeof(TextureCache::Level) == 24, "cache file layout changed");
+
+	constexpr size_t TILE_TEXELS = TextureCache::TILE_SIZE * TextureCache::TILE_SIZE;
+	//keys are the image id, the level and the tile index, ids start at 1 so 0 is never a valid key
+	constexpr uint64_t EMPTY_KEY = 0;
+	constexpr uint32_t MAX_TILES = 1 << 26;
+	constexpr int SHARD_COUNT = 64;
+	constexpr int LOOKASIDE_SIZE = 64;
+
+	//the version is odd while the tile in the slot is being replaced
+	//readers check it didn't change around reading a texel, so they never need a lock
+	struct Slot {
+		std::atomic<uint64_t> version = 0;
+		std::atomic<uint64_t> key = EMPTY_KEY;
+		//set on every use, the clock hand clears it and takes slots that stayed unused for a whole round
+		std::atomic<bool> referenced = false;
+	};
+
+	struct Shard {
+		std::mutex mutex;
+		std::unordered_map<uint64_t, uint32_t> tiles;
+	};
+
+	struct TilePool {
+		std::vector<Slot> slots;
+		//texels aren't touched until a tile is loaded into their slot, the budget is only used up as tiles are loaded
+		std::unique_ptr<std::atomic<uint32_t>[]> texels;
+		std::atomic<uint64_t> hand = 0;
+		std::atomic<size_t> resident = 0;
+		std::atomic<uint64_t> loads = 0;
+		Shard shards[SHARD_COUNT];
+
+		TilePool()
+		{
+			//enough slots that threads can't keep taking each others tiles away before reading them
+			size_t minimum = 16 * (size_t)std::max(1u, std::thread::hardware_concurrency());
+			size_t count = std::max(minimum, TextureCache::memory_budget / TextureCache::TILE_BYTES);
+			slots = std::vector<Slot>(count);
+			texels.reset(new std::atomic<uint32_t>[count * TILE_TEXELS]);
+		}
+	};
+
+	static TilePool& Pool()
+	{
+		static TilePool pool;
+		return pool;
+	}
+
+	//recently used tiles of every thread, hits skip the shard locks
+	struct Lookaside {
+		uint64_t keys[LOOKASIDE_SIZE] = {};
+		uint32_t slots[LOOKASIDE_SIZE] = {};
+	};
+
+	static uint64_t MixKey(uint64_t key)
+	{
+		return (key ^ (key >> 29)) * 0xbf58476d1ce4e5b9ull;
+	}
+
+	std::shared_ptr<TextureCache::Image> TextureCache::Image::Open(const std::string& path)
+	{
+		static std::atomic<uint32_t> next_id = 1;
+
+		std::shared_ptr<MappedFile> file = MappedFile::Open(path);
+		if (!file || file->Size() < sizeof(CacheFileHeader)) {
+			return nullptr;
+		}
+		const CacheFileHeader* header = (const CacheFileHeader*)file->Data();
+		if (memcmp(header->magic, CACHE_FILE_MAGIC, sizeof(CACHE_FILE_MAGIC)) != 0 || header->version != CACHE_FILE_VERSION
+			|| header->level_count == 0 || header->level_count > 32
+			|| file->Size() < sizeof(CacheFileHeader) + header->level_count * sizeof(Level)) {
+			return nullptr;
+		}
+
+		std::shared_ptr<Image> ret(new Image());
+		ret->levels.resize(header->level_count);
+		memcpy(ret->levels.data(), file->Data() + sizeof(CacheFileHeader), header->level_count * sizeof(Level));
+		for (const Level& level : ret->levels) {
+			uint64_t tiles = (uint64_t)level.tiles_x * level.tiles_y;
+			if (level.width == 0 || level.height == 0 || tiles > MAX_TILES
+				|| level.tiles_x != (level.width + TILE_SIZE - 1) / TILE_SIZE || level.tiles_y != (level.height + TILE_SIZE - 1) / TILE_SIZE
+				|| level.offset % TILE_BYTES != 0 || level.offset + tiles * TILE_BYTES > file->Size()) {
+				return nullptr;
+			}
+		}
+		ret->file = file;
+		ret->channels = header->channels;
+		ret->id = next_id++;
+		return ret;
+	}
+
+	bool TextureCache::Image::Write(const std::string& path, uint32_t channels, const std::vector<glm::uvec2>& sizes,
+		const std::function<void(uint32_t level, uint32_t tile_x, uint32_t tile_y, uint32_t* texels)>& fill)
+	{
+		MYPBRT_TRACE_SCOPE("TextureCache::Image::Write");
+		CacheFileHeader header = {};
+		memcpy(header.magic, CACHE_FILE_MAGIC, sizeof(CACHE_FILE_MAGIC));
+		header.version = CACHE_FILE_VERSION;
+		header.channels = channels;
+		header.level_count = (uint32_t)sizes.size();
+
+		std::vector<Level> levels;
+		uint64_t offset = (sizeof(CacheFileHeader) + sizes.size() * sizeof(Level) + TILE_BYTES - 1) / TILE_BYTES * TILE_BYTES;
+		for (const glm::uvec2& size : sizes) {
+			Level level = { size.x, size.y, (size.x + TILE_SIZE - 1) / TILE_SIZE, (size.y + TILE_SIZE - 1) / TILE_SIZE, offset };
+			offset += (uint64_t)level.tiles_x * level.tiles_y * TILE_BYTES;
+			levels.push_back(level);
+		}
+
+		//written next to its final name and renamed, so a half written file is never opened
+		std::error_code error;
+		std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+		std::string temporary_path = path + ".tmp";
+		std::ofstream file(temporary_path, std::ios::binary);
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)levels.data(), levels.size() * sizeof(Level));
+
+		std::vector<uint32_t> tile(TILE_TEXELS);
+		for (uint32_t i = 0; i < levels.size(); i++) {
+			file.seekp(levels[i].offset);
+			for (uint32_t y = 0; y < levels[i].tiles_y; y++) {
+				for (uint32_t x = 0; x < levels[i].tiles_x; x++) {
+					std::fill(tile.begin(), tile.end(), 0);
+					fill(i, x, y, tile.data());
+					file.write((const char*)tile.data(), TILE_BYTES);
+				}
+			}
+		}
+		file.close();
+		if (!file.good()) {
+			std::filesystem::remove(temporary_path, error);
+			return false;
+		}
+		std::filesystem::rename(temporary_path, path, error);
+		return !error;
+	}
+
+	uint32_t TextureCache::Image::Texel(uint32_t level, uint32_t x, uint32_t y) const
+	{
+		thread_local Lookaside lookaside;
+
+		const Level& l = levels[level];
+		uint32_t tile = (y >> TILE_SHIFT) * l.tiles_x + (x >> TILE_SHIFT);
+		uint32_t offset = ((y & (TILE_SIZE - 1)) << TILE_SHIFT) + (x & (TILE_SIZE - 1));
+		uint64_t key = ((uint64_t)id << 32) | ((uint64_t)level << 26) | tile;
+		int index = (int)(MixKey(key) >> 58);
+
+		TilePool& pool = Pool();
+		while (true) {
+			if (lookaside.keys[index] == key) {
+				uint32_t s = lookaside.slots[index];
+				Slot& slot = pool.slots[s];
+				uint64_t version = slot.version.load(std::memory_order_acquire);
+				if ((version & 1) == 0 && slot.key.load(std::memory_order_relaxed) == key) {
+					uint32_t texel = pool.texels[s * TILE_TEXELS + offset].load(std::memory_order_relaxed);
+					std::atomic_thread_fence(std::memory_order_acquire);
+					if (slot.version.load(std::memory_order_relaxed) == version) {
+						//only written when it changes so threads sharing a tile don't fight over the cache line
+						if (!slot.referenced.load(std::memory_order_relaxed)) {
+							slot.referenced.store(true, std::memory_order_relaxed);
+						}
+						return texel;
+					}
+				}
+			}
+			lookaside.keys[index] = key;
+			lookaside.slots[index] = Find(*this, level, tile, key);
+		}
+	}
+
+	uint32_t TextureCache::Find(const Image& image, uint32_t level, uint32_t tile, uint64_t key)
+	{
+		TilePool& pool = Pool();
+		Shard& shard = pool.shards[MixKey(key) % SHARD_COUNT];
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			auto it = shard.tiles.find(key);
+			if (it != shard.tiles.end()) {
+				return it->second;
+			}
+		}
+
+		//takes the first slot the hand finds unused since its last round
+		uint32_t s;
+		uint64_t version;
+		while (true) {
+			s = (uint32_t)(pool.hand.fetch_add(1, std::memory_order_relaxed) % pool.slots.size());
+			Slot& slot = pool.slots[s];
+			if (slot.referenced.exchange(false, std::memory_order_relaxed)) {
+				continue;
+			}
+			version = slot.version.load(std::memory_order_relaxed);
+			if ((version & 1) == 0 && slot.version.compare_exchange_strong(version, version + 1, std::memory_order_acq_rel)) {
+				break;
+			}
+		}
+		Slot& slot = pool.slots[s];
+
+		uint64_t evicted = slot.key.load(std::memory_order_relaxed);
+		if (evicted != EMPTY_KEY) {
+			Shard& other = pool.shards[MixKey(evicted) % SHARD_COUNT];
+			std::lock_guard<std::mutex> lock(other.mutex);
+			auto it = other.tiles.find(evicted);
+			if (it != other.tiles.end() && it->second == s) {
+				other.tiles.erase(it);
+			}
+		}
+		if (version == 0) {
+			pool.resident += TILE_BYTES;
+		}
+
+		//the file is mapped, only the pages of tiles that get used are ever read from disk
+		MYPBRT_TRACE_SCOPE("TextureCache::LoadTile");
+		MYPBRT_COUNT(TextureTileLoads);
+		const uint8_t* source = image.file->Data() + image.levels[level].offset + (uint64_t)tile * TILE_BYTES;
+		std::atomic<uint32_t>* texels = &pool.texels[s * TILE_TEXELS];
+		for (size_t i = 0; i < TILE_TEXELS; i++) {
+			uint32_t texel;
+			memcpy(&texel, source + i * sizeof(uint32_t), sizeof(uint32_t));
+			texels[i].store(texel, std::memory_order_relaxed);
+		}
+		pool.loads++;
+
+		//the tile is in the map before the slot can be taken again, so whoever takes it also removes it from there
+		//another thread might have loaded the same tile meanwhile, then its copy is used and this slot is left empty
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		auto [it, inserted] = shard.tiles.emplace(key, s);
+		slot.key.store(inserted ? key : EMPTY_KEY, std::memory_order_relaxed);
+		slot.referenced.store(inserted, std::memory_order_relaxed);
+		slot.version.store(version + 2, std::memory_order_release);
+		return it->second;
+	}
+
+	size_t TextureCache::ResidentBytes()
+	{
+		return Pool().resident;
+	}
+
+	uint64_t TextureCache::TileLoads()
+	{
+		return Pool().loads;
+	}
+
+}
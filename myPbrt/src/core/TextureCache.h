@@ -0,0 +1,69 @@
+#pragma once
+
+#include "core.h"
+#include "MappedFile.h"
+
+#include <functional>
+
+//images converted into files of tiled mip levels, only the tiles that lookups touch are kept in memory
+//every tile is 32x32 packed rgba8 texels, 4 KB, tiles of a level are stored row by row
+//a fixed number of tile slots is shared by all cached images, tiles that weren't used lately make room for new ones
+
+namespace MyPBRT {
+
+	class TextureCache
+	{
+	public:
+		static constexpr uint32_t TILE_SHIFT = 5;
+		static constexpr uint32_t TILE_SIZE = 1 << TILE_SHIFT;
+		static constexpr size_t TILE_BYTES = TILE_SIZE * TILE_SIZE * sizeof(uint32_t);
+
+		//bytes of tiles kept in memory, 0 keeps whole images in memory instead
+		//the slots are created once the first tile is loaded, changing it afterwards has no effect
+		static size_t memory_budget;
+		//where converted images are written, they are named after a hash of the file they came from
+		static std::string folder;
+
+		struct Level {
+			uint32_t width;
+			uint32_t height;
+			uint32_t tiles_x;
+			uint32_t tiles_y;
+			uint64_t offset;
+		};
+
+		class Image {
+		public:
+			//nullptr if there is no valid cache file at path
+			static std::shared_ptr<Image> Open(const std::string& path);
+			//writes a cache file of the given level sizes, fill writes the texels of a tile row by row
+			static bool Write(const std::string& path, uint32_t channels, const std::vector<glm::uvec2>& sizes,
+				const std::function<void(uint32_t level, uint32_t tile_x, uint32_t tile_y, uint32_t* texels)>& fill);
+
+			//packed texel, loads its tile if it isn't in memory
+			uint32_t Texel(uint32_t level, uint32_t x, uint32_t y) const;
+
+			const std::vector<Level>& Levels() const { return levels; }
+			uint32_t Channels() const { return channels; }
+
+		private:
+			friend class TextureCache;
+			Image() = default;
+
+			std::shared_ptr<MappedFile> file;
+			std::vector<Level> levels;
+			uint32_t channels = 4;
+			//part of every tile key, never reused so tiles of closed images can't be mistaken for new ones
+			uint32_t id = 0;
+		};
+
+		//bytes of tiles currently loaded and how many tiles were read since the start
+		static size_t ResidentBytes();
+		static uint64_t TileLoads();
+
+	private:
+		friend class Image;
+		static uint32_t Find(const Image& image, uint32_t level, uint32_t tile, uint64_t key);
+	};
+
+}
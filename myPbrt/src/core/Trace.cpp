@@ -0,0 +1,139 @@
+#include "Trace.h"
+
+#include <mutex>
+#include <fstream>
+#include <iomanip>
+
+namespace MyPBRT {
+
+	namespace Trace {
+
+		//the owning thread is the only writer, a dump copies the slots and then drops the ones that
+		//got overwritten in the meantime by checking the head again
+		struct ThreadBuffer {
+			struct Slot {
+				std::atomic<const char*> name{ nullptr };
+				std::atomic<uint64_t> start{ 0 };
+				std::atomic<uint64_t> end{ 0 };
+			};
+
+			std::unique_ptr<Slot[]> slots{ new Slot[RING_SIZE] };
+			std::atomic<uint64_t> head{ 0 };
+			uint32_t id = 0;
+			std::string name;
+		};
+
+		static std::atomic<bool> enabled{ true };
+		static const auto epoch = std::chrono::steady_clock::now();
+
+		static std::mutex registry_mutex;
+		//buffers outlive their threads so a dump still shows them
+		static std::vector<std::shared_ptr<ThreadBuffer>> registry;
+
+		static ThreadBuffer& LocalBuffer()
+		{
+			thread_local std::shared_ptr<ThreadBuffer> buffer = [] {
+				std::shared_ptr<ThreadBuffer> buffer(new ThreadBuffer());
+				std::lock_guard<std::mutex> lock(registry_mutex);
+				buffer->id = (uint32_t)registry.size() + 1;
+				registry.push_back(buffer);
+				return buffer;
+			}();
+			return *buffer;
+		}
+
+		void SetEnabled(bool _enabled)
+		{
+			enabled.store(_enabled, std::memory_order_relaxed);
+		}
+
+		bool Enabled()
+		{
+			return enabled.load(std::memory_order_relaxed);
+		}
+
+		void SetThreadName(const std::string& name)
+		{
+			ThreadBuffer& buffer = LocalBuffer();
+			std::lock_guard<std::mutex> lock(registry_mutex);
+			buffer.name = name;
+		}
+
+		uint64_t Now()
+		{
+			//never 0 so a scope can use it to tell it was not recording
+			return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count() + 1;
+		}
+
+		void Record(const char* name, uint64_t start, uint64_t end)
+		{
+			ThreadBuffer& buffer = LocalBuffer();
+			uint64_t head = buffer.head.load(std::memory_order_relaxed);
+			ThreadBuffer::Slot& slot = buffer.slots[head % RING_SIZE];
+			slot.name.store(name, std::memory_order_relaxed);
+			slot.start.store(start, std::memory_order_relaxed);
+			slot.end.store(end, std::memory_order_relaxed);
+			buffer.head.store(head + 1, std::memory_order_release);
+		}
+
+		static void WriteEscaped(std::ofstream& file, const std::string& str)
+		{
+			for (char c : str) {
+				if (c == '"' || c == '\\') file << '\\';
+				if ((unsigned char)c < 0x20) continue;
+				file << c;
+			}
+		}
+
+		bool Dump(const std::string& path)
+		{
+			std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+			{
+				std::lock_guard<std::mutex> lock(registry_mutex);
+				buffers = registry;
+			}
+
+			std::ofstream file(path);
+			if (!file.is_open()) return false;
+
+			file << std::fixed << std::setprecision(3);
+			file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+			bool first = true;
+			for (auto& buffer : buffers) {
+				std::string name;
+				{
+					std::lock_guard<std::mutex> lock(registry_mutex);
+					name = buffer->name.empty() ? "thread " + std::to_string(buffer->id) : buffer->name;
+				}
+				file << (first ? "" : ",\n") << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id << ",\"name\":\"thread_name\",\"args\":{\"name\":\"";
+				WriteEscaped(file, name);
+				file << "\"}}";
+				first = false;
+
+				struct Event { const char* name; uint64_t start, end; };
+				std::vector<Event> events;
+				uint64_t head = buffer->head.load(std::memory_order_acquire);
+				uint64_t begin = head > RING_SIZE ? head - RING_SIZE : 0;
+				for (uint64_t i = begin; i < head; i++) {
+					ThreadBuffer::Slot& slot = buffer->slots[i % RING_SIZE];
+					events.push_back({ slot.name.load(std::memory_order_relaxed), slot.start.load(std::memory_order_relaxed), slot.end.load(std::memory_order_relaxed) });
+				}
+
+				//everything below the new head minus the ring size may have been overwritten while copying
+				uint64_t new_head = buffer->head.load(std::memory_order_acquire);
+				uint64_t valid = new_head > RING_SIZE ? new_head - RING_SIZE : 0;
+				for (uint64_t i = std::max(begin, valid); i < head; i++) {
+					const Event& event = events[i - begin];
+					if (event.name == nullptr) continue;
+					file << ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->id << ",\"name\":\"";
+					WriteEscaped(file, event.name);
+					file << "\",\"ts\":" << event.start / 1000.0 << ",\"dur\":" << (event.end - event.start) / 1000.0 << "}";
+				}
+			}
+			file << "\n]}\n";
+			return file.good();
+		}
+
+	}
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "core.h"
+
+#include <atomic>
+#include <chrono>
+
+//scoped zones recorded into a ring buffer per thread, Dump writes the chrome trace format
+//that chrome://tracing and ui.perfetto.dev open, MYPBRT_NO_TRACE compiles the zones out
+
+namespace MyPBRT {
+
+	namespace Trace {
+
+		//newest zones of a thread kept around for a dump
+		constexpr uint32_t RING_SIZE = 1 << 14;
+
+		void SetEnabled(bool enabled);
+		bool Enabled();
+		//shown instead of the thread number
+		void SetThreadName(const std::string& name);
+		//false if the file couldn't be written
+		bool Dump(const std::string& path);
+
+		uint64_t Now();
+		void Record(const char* name, uint64_t start, uint64_t end);
+
+		class Scope {
+		public:
+			//name has to outlive the dump, string literals are what it's meant for
+			Scope(const char* _name) : name(_name), start(Enabled() ? Now() : 0) {}
+			~Scope() { if (start != 0) Record(name, start, Now()); }
+
+		private:
+			const char* name;
+			uint64_t start;
+		};
+	}
+
+}
+
+#define MYPBRT_TRACE_CONCAT_(a, b) a##b
+#define MYPBRT_TRACE_CONCAT(a, b) MYPBRT_TRACE_CONCAT_(a, b)
+
+#ifndef MYPBRT_NO_TRACE
+#define MYPBRT_TRACE_SCOPE(name) ::MyPBRT::Trace::Scope MYPBRT_TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#else
+#define MYPBRT_TRACE_SCOPE(name) ((void)0)
+#endif
@@ -24,7 +24,7 @@ constexpr float INVPIf = 0.31830988618379067154f;
 
 //glm
 #include <glm/glm.hpp>
-#include <glm/gtx/norm.hpp >
+#include <glm/gtx/norm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 //MyPBRT
@@ -41,6 +41,7 @@ namespace MyPBRT {
 	class Integrator;
 	class SurfaceInteraction;
 	class Material;
+	struct MaterialRecord;
 	template <typename T>
 	class ConstantTexture;
 	class CheckerboardTexture;
@@ -66,10 +67,27 @@ namespace MyPBRT {
 		return (word >> 22u) ^ word;
 	}
 
+	//every sample gets its own stream, the n-th number drawn from it is hash(pixel, sample, n)
+	//so the result does not depend on which thread ends up tracing the sample
+	struct RandomStream {
+		uint32_t seed = 0;
+		uint32_t dimension = 0;
+	};
+
+	inline RandomStream& random_stream() {
+		thread_local RandomStream stream;
+		return stream;
+	}
+
+	inline void seed_random(uint32_t pixel, uint32_t sample) {
+		RandomStream& stream = random_stream();
+		stream.seed = pcg_hash(pixel + pcg_hash(sample));
+		stream.dimension = 0;
+	}
+
 	inline uint32_t random_uint() {
-		thread_local uint32_t seed = rand();
-		seed = pcg_hash(seed);
-		return seed;
+		RandomStream& stream = random_stream();
+		return pcg_hash(stream.seed ^ pcg_hash(stream.dimension++));
 	}
 
 	inline int random_int(int min, int max) {